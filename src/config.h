@@ -1,6 +1,7 @@
 #ifndef FINDIR_CONFIG_H
 #define FINDIR_CONFIG_H
 
+#include <algorithm>
 #include <filesystem>
 #include <set>
 #include <string>
@@ -12,6 +13,8 @@
 #include "types.h"
 
 const constexpr int MAXIMUM_FILE_PATH = 512;
+// upper bound on "max_tracked_directories", about 180 MB per search
+const constexpr int MAXIMUM_TRACKED_DIRECTORIES = 1 << 24;
 using StringsContainer = std::set<std::string>;
 
 // template <typename T, typename C>
@@ -56,6 +59,24 @@ public:
   bool use_recursion = false;
   int recursion_depth = 0;
   bool exit_on_search = true;
+  std::vector<std::string> exclude_directories = {};
+  // prebuilt index from 'find-directory-indexer.exe', may be empty
+  std::string index_file = "";
+  // bounds on directory reads in flight, tuned automatically in between
+  int min_concurrent_reads = 1;
+  int max_concurrent_reads = 16;
+  // directories remembered for cycle detection, allocated up front at
+  // about 11 bytes each when a search recurses, 0 turns it off
+  int max_tracked_directories = 1 << 20;
+  // stop searching after this many matches, 0 = no limit
+  int max_results = 0;
+  // write a timeline of every search to 'trace.json'
+  bool trace_searches = false;
+  // recently opened paths, shown before a search finishes; see History
+  std::string history_file = "find-directory-history.toml";
+  int max_history = 200; // 0 turns the history off
+  // snapshots of search results to compare later searches against
+  std::string snapshot_directory = "snapshots";
 
   Settings() = delete;
   /**
@@ -89,6 +110,26 @@ public:
       default_search_path =
         toml::find_or<std::string>(data, "default_search_path", "");
 
+      exclude_directories = toml::find_or<std::vector<std::string>>(
+        data, "exclude_directories", {});
+      index_file = toml::find_or<std::string>(data, "index_file", "");
+      min_concurrent_reads =
+        toml::find_or<int>(data, "min_concurrent_reads", 1);
+      max_concurrent_reads =
+        toml::find_or<int>(data, "max_concurrent_reads", 16);
+      max_tracked_directories = std::clamp(
+        toml::find_or<int>(data, "max_tracked_directories", 1 << 20),
+        0,
+        MAXIMUM_TRACKED_DIRECTORIES);
+      trace_searches =
+        toml::find_or<bool>(data, "trace_searches", false);
+      max_results = toml::find_or<int>(data, "max_results", 0);
+      history_file = toml::find_or<std::string>(
+        data, "history_file", "find-directory-history.toml");
+      max_history = toml::find_or<int>(data, "max_history", 200);
+      snapshot_directory = toml::find_or<std::string>(
+        data, "snapshot_directory", "snapshots");
+
       auto& paths = toml::find(data, "bookmarks").as_array();
       bookmarks = MakeContainer(paths);
     }
@@ -108,6 +149,16 @@ public:
       { "use_recursion", use_recursion },
       { "recursion_depth", recursion_depth },
       { "default_search_path", default_search_path },
+      { "exclude_directories", exclude_directories },
+      { "index_file", index_file },
+      { "min_concurrent_reads", min_concurrent_reads },
+      { "max_concurrent_reads", max_concurrent_reads },
+      { "max_tracked_directories", max_tracked_directories },
+      { "trace_searches", trace_searches },
+      { "max_results", max_results },
+      { "history_file", history_file },
+      { "max_history", max_history },
+      { "snapshot_directory", snapshot_directory },
       { "bookmarks", bookmarks },
     };
 
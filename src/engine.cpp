@@ -0,0 +1,314 @@
+#include "engine.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <future>
+#include <regex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include "filter.h"
+#include "index.h"
+#include "log.h"
+#include "match.h"
+#include "search.h"
+#include "text.h"
+#include "trace.h"
+#include "visited.h"
+#include "walker.h"
+
+namespace {
+
+// Calls 'f' when it goes out of scope, also through an exception.
+template<typename F>
+class ScopeExit
+{
+private:
+  F f_;
+
+public:
+  explicit ScopeExit(F f)
+    : f_(std::move(f))
+  {
+  }
+  ~ScopeExit() { f_(); }
+
+  ScopeExit(const ScopeExit&) = delete;
+  ScopeExit& operator=(const ScopeExit&) = delete;
+};
+
+} // namespace
+
+SearchEngine::SearchEngine()
+  : pool_(static_cast<int>(std::thread::hardware_concurrency()))
+{
+}
+
+SearchEngine::~SearchEngine()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock,
+             [this]() { return running_ == 0 && background_ == 0; });
+}
+
+SearchHandle
+SearchEngine::Start(SearchQuery query, SearchCallbacks callbacks)
+{
+  // A search waits for the walk's reader threads or the index matching
+  // helpers, which need workers of their own besides its own. Searches
+  // running at the same time each need that many.
+  const WalkLimits limits{ query.limits.min_concurrent_reads,
+                           query.limits.max_concurrent_reads };
+  const auto cores =
+    static_cast<int>(std::thread::hardware_concurrency());
+  const int workers = 1 + std::max(limits.readers(), cores);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_++;
+    needed_workers_ += workers;
+    pool_.Reserve(needed_workers_);
+  }
+
+  SearchHandle handle;
+  handle.cancel_ = std::make_shared<std::atomic<bool>>(false);
+  handle.done_ =
+    pool_
+      .Submit([this,
+               workers,
+               query = std::move(query),
+               callbacks = std::move(callbacks),
+               cancel = handle.cancel_]() mutable {
+        // however Run() ends, so that the engine can still go away
+        ScopeExit finished([this, workers]() {
+          std::lock_guard<std::mutex> lock(mutex_);
+          running_--;
+          needed_workers_ -= workers;
+          idle_.notify_all();
+        });
+        Run(query, callbacks, *cancel);
+      })
+      .share();
+  return handle;
+}
+
+std::future<void>
+SearchEngine::Submit(std::function<void()> task)
+{
+  // one worker of its own, so that it can't hold up a search
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    background_++;
+    needed_workers_++;
+    pool_.Reserve(needed_workers_);
+  }
+  return pool_.Submit([this, task = std::move(task)]() {
+    // an exception is passed on to the future
+    ScopeExit finished([this]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      background_--;
+      needed_workers_--;
+      idle_.notify_all();
+    });
+    task();
+  });
+}
+
+void
+SearchEngine::Run(const SearchQuery& query,
+                  SearchCallbacks& callbacks,
+                  const std::atomic<bool>& cancel)
+{
+  const auto search_path = PathFromUtf8(query.root);
+  SearchStats stats;
+
+  if (trace::Enabled()) {
+    trace::NameThread("search");
+  }
+  trace::Span search_span("search", query.root);
+
+  auto finish = [&]() {
+    stats.cancelled = cancel.load();
+    // recorded before a consumer can stop the trace
+    search_span.End();
+    if (callbacks.on_finished) {
+      callbacks.on_finished(stats);
+    }
+  };
+
+  // Matches are handed over in batches: when one is full, and when the
+  // walk polls for cancellation, at least every 50ms, once the oldest
+  // match waited long enough.
+  Strings batch;
+  auto batch_started = std::chrono::steady_clock::now();
+  auto hand_over = [&]() {
+    if (!batch.empty() && callbacks.on_results) {
+      callbacks.on_results(std::move(batch));
+    }
+    batch.clear();
+  };
+
+  try {
+    // Check to see if the path exists with a timeout. An unreachable
+    // share can take much longer to answer; the check is left to finish
+    // on a thread of its own so that it never holds a pool worker or
+    // keeps the pool from shutting down.
+    std::promise<bool> exists;
+    auto future = exists.get_future();
+    std::thread([search_path, exists = std::move(exists)]() mutable {
+      std::error_code ec;
+      exists.set_value(std::filesystem::exists(search_path, ec));
+    }).detach();
+    if (future.wait_for(std::chrono::milliseconds(1000)) !=
+        std::future_status::ready) {
+      stats.error = "Couldn't access the path in a reasonable amount "
+                    "of time.\nIt may be in-accessible or not exist.";
+      finish();
+      return;
+    }
+    if (!future.get()) {
+      stats.error = "The path does not exist.";
+      finish();
+      return;
+    }
+
+    // compiled once per search, checked before descending into a
+    // directory so that excluded subtrees are never listed
+    const DirectoryFilter filter(query.exclude_directories);
+    // text searches are plain substring comparisons of the folded
+    // path, regex patterns are folded and compiled without 'icase'
+    const Matcher matcher(query.pattern, query.mode == MatchMode::text);
+    const WalkLimits limits{ query.limits.min_concurrent_reads,
+                             query.limits.max_concurrent_reads };
+    // one set for the whole search so that the live walks of an index
+    // search share it too; a search of the root's children only never
+    // meets a directory twice and doesn't need one
+    VisitedSet visited(
+      query.depth == 1
+        ? 0
+        : std::max(0, query.limits.max_tracked_directories));
+    auto should_stop = [&]() {
+      const auto age = std::chrono::steady_clock::now() - batch_started;
+      if (!batch.empty() && age >= result_batch_age) {
+        hand_over();
+      }
+      return stats.result_limit_reached || cancel.load();
+    };
+    // threads matching index chunks besides this one
+    const int helpers =
+      static_cast<int>(std::thread::hardware_concurrency()) - 1;
+
+    // Every branch hands matches over as they are found, so no matches
+    // are held here; the walk's frontier of pending directories and the
+    // listings read ahead of their turn (see Walk()) are all there is.
+    // Once 'max_results' matches were reported the search stops.
+    const int max_results = query.limits.max_results;
+    int result_count = 0;
+    auto report = [&](std::string text) {
+      if (stats.result_limit_reached) {
+        return;
+      }
+      FINDIR_DEBUG_EVERY(logs::search(), 100, "path found: {}", text);
+      if (batch.empty()) {
+        batch_started = std::chrono::steady_clock::now();
+      }
+      batch.push_back(std::move(text));
+      if (batch.size() >= result_batch_size) {
+        hand_over();
+      }
+      if (max_results > 0 && ++result_count >= max_results) {
+        stats.result_limit_reached = true;
+      }
+    };
+
+    // A prebuilt index answers recursive searches of the indexed root.
+    // It's mapped for this search only: Windows can't replace a file
+    // while a view of it is mapped, and the indexer replaces it.
+    std::unique_ptr<const dirindex::IndexView> index;
+    if (query.depth != 1 && !query.index_file.empty()) {
+      try {
+        index = std::make_unique<const dirindex::IndexView>(
+          PathFromUtf8(query.index_file));
+        if (!IndexCovers(*index, search_path, query.depth)) {
+          index.reset();
+        }
+      } catch (const std::runtime_error& e) {
+        logs::search()->warn("index file not used: {}", e.what());
+      }
+    }
+
+    if (index) {
+      SearchIndex(
+        *index,
+        search_path,
+        query.depth,
+        filter,
+        matcher,
+        pool_,
+        helpers,
+        stats,
+        report,
+        [&](const std::filesystem::path& folder, int depth) {
+          Walk(folder,
+               depth,
+               false,
+               filter,
+               limits,
+               visited,
+               pool_,
+               matcher,
+               stats,
+               report,
+               should_stop);
+        },
+        should_stop);
+    } else if (query.depth != 1) {
+      // files are matched too when the depth is unlimited
+      Walk(search_path,
+           query.depth,
+           query.depth == 0,
+           filter,
+           limits,
+           visited,
+           pool_,
+           matcher,
+           stats,
+           report,
+           should_stop);
+    } else {
+      // no recursion, only search the folder names in the directory
+      for (auto const& entry :
+           std::filesystem::directory_iterator{ search_path }) {
+        if (should_stop()) {
+          break;
+        }
+        const FoldedString path(entry.path());
+        if (entry.is_directory() &&
+            filter.Excludes(path.folded_name())) {
+          stats.directories_pruned++;
+          continue;
+        }
+        if (matcher.Matches(path.folded)) {
+          report(path.text);
+        }
+      }
+    }
+  } catch (std::filesystem::filesystem_error& e) {
+    stats.error = e.what();
+  } catch (std::regex_error& e) {
+    stats.error = e.what();
+  } catch (std::exception& e) {
+    // e.g. bad_alloc, reported like any other failure so that the
+    // search still finishes
+    stats.error = e.what();
+  }
+  hand_over();
+  logs::search()->info(
+    "directories read: {}, read retries: {}, peak concurrent reads: "
+    "{}, peak pending directories: {}",
+    stats.directories_read,
+    stats.read_retries,
+    stats.peak_concurrent_reads,
+    stats.peak_pending_directories);
+  finish();
+}
@@ -0,0 +1,156 @@
+#ifndef FINDIR_ENGINE_H
+#define FINDIR_ENGINE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pool.h"
+#include "types.h"
+
+/**
+ * Search engine without any GUI, built as its own static library
+ * (find-directory-engine) so that tools and tests can drive it too.
+ *
+ *   SearchEngine engine;
+ *   SearchQuery query;
+ *   query.root = "L:/";
+ *   query.pattern = "dunkin";
+ *   query.mode = MatchMode::text;
+ *   auto search = engine.Start(query, {
+ *     [](Strings&& batch) { ... },
+ *     [](const SearchStats& stats) { ... } });
+ *   search.Wait();
+ *
+ * One engine can run any number of searches, one after the other or at
+ * the same time. It keeps its threads between searches; an index file
+ * is only mapped while a search reads it, so that the indexer can
+ * replace it in between.
+ */
+
+enum class MatchMode
+{
+  regex, // ECMAScript, case insensitive
+  text   // case insensitive substring
+};
+
+struct SearchLimits
+{
+  // stop after this many matches, 0 = no limit
+  int max_results = 0;
+  // bounds on directory reads in flight, tuned in between
+  int min_concurrent_reads = 1;
+  int max_concurrent_reads = 16;
+  // directories remembered for cycle detection, about 11 bytes each
+  // allocated up front by recursive searches, 0 = off
+  int max_tracked_directories = 1 << 20;
+};
+
+struct SearchQuery
+{
+  std::string root;    // UTF-8
+  std::string pattern; // UTF-8
+  MatchMode mode = MatchMode::regex;
+  // levels below the root that are searched, 1 = the root's children
+  // only, 0 = unlimited. Only unlimited searches match files too.
+  int depth = 1;
+  SearchLimits limits;
+  // see DirectoryFilter
+  std::vector<std::string> exclude_directories;
+  // prebuilt index from 'find-directory-indexer.exe', may be empty
+  std::string index_file;
+};
+
+/**
+ * Called on the search's thread. 'on_results' gets the UTF-8 paths of
+ * matches in batches; it may block, which slows the search down.
+ * 'on_finished' is called exactly once, last, also after a failure or
+ * cancel.
+ */
+struct SearchCallbacks
+{
+  std::function<void(Strings&&)> on_results;
+  std::function<void(const SearchStats&)> on_finished;
+};
+
+// Matches are handed over once a batch is this big, or once the oldest
+// match in it is this old.
+const constexpr size_t result_batch_size = 256;
+const constexpr auto result_batch_age = std::chrono::milliseconds(30);
+
+class SearchHandle
+{
+  friend class SearchEngine;
+
+private:
+  std::shared_ptr<std::atomic<bool>> cancel_;
+  std::shared_future<void> done_;
+
+public:
+  SearchHandle() = default;
+
+  // false for a default constructed handle
+  bool valid() const { return done_.valid(); }
+
+  // Asks the search to stop soon; on_finished is still called.
+  void Cancel()
+  {
+    if (cancel_) {
+      *cancel_ = true;
+    }
+  }
+
+  // Returns once on_finished returned.
+  void Wait() const
+  {
+    if (done_.valid()) {
+      done_.wait();
+    }
+  }
+
+  bool Done() const
+  {
+    return !done_.valid() ||
+           done_.wait_for(std::chrono::seconds(0)) ==
+             std::future_status::ready;
+  }
+};
+
+class SearchEngine
+{
+private:
+  ThreadPool pool_;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  int running_ = 0;    // searches started and not finished
+  int background_ = 0; // tasks from Submit() not finished
+  // pool workers the running searches and tasks need at most
+  int needed_workers_ = 0;
+  void Run(const SearchQuery& query,
+           SearchCallbacks& callbacks,
+           const std::atomic<bool>& cancel);
+
+public:
+  SearchEngine();
+  // Waits for running searches and tasks; cancel searches first.
+  ~SearchEngine();
+
+  SearchEngine(const SearchEngine&) = delete;
+  SearchEngine& operator=(const SearchEngine&) = delete;
+
+  // Starts searching in the background and returns right away.
+  SearchHandle Start(SearchQuery query, SearchCallbacks callbacks);
+
+  // Runs 'task' on the engine's threads, for slow work of its users
+  // that shouldn't hold up a GUI thread, e.g. comparing snapshots.
+  // Waited for like searches when the engine goes away.
+  std::future<void> Submit(std::function<void()> task);
+};
+
+#endif /* FINDIR_ENGINE_H */
@@ -0,0 +1,125 @@
+#ifndef FINDIR_FILTER_H
+#define FINDIR_FILTER_H
+
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "match.h"
+#include "text.h"
+
+/**
+ * Translate a shell style glob into an equivalent regular expression.
+ * Supports '*' (any run of characters) and '?' (any single character).
+ * Every other character is matched literally.
+ */
+inline std::string
+GlobToRegex(const std::string& glob)
+{
+  std::string out;
+  out.reserve(glob.size() * 2);
+  for (const char c : glob) {
+    switch (c) {
+      case '*':
+        out += ".*";
+        break;
+      case '?':
+        out += '.';
+        break;
+      case '.':
+      case '\\':
+      case '+':
+      case '^':
+      case '$':
+      case '(':
+      case ')':
+      case '[':
+      case ']':
+      case '{':
+      case '}':
+      case '|':
+        out += '\\';
+        out += c;
+        break;
+      default:
+        out += c;
+        break;
+    }
+  }
+  return out;
+}
+
+/**
+ * Set of exclusion rules checked against a directory name before the
+ * walker descends into it. Rules are compiled once per search.
+ *
+ * Rule syntax (from the settings file):
+ *   "node_modules"  - exact folder name
+ *   "Revit*Temp"    - glob, '*' and '?' wildcards
+ *   "re:^~.*"       - regular expression
+ *
+ * All rules match the whole folder name and are case insensitive.
+ * Like Matcher, rules are folded once when compiled rather than using
+ * std::regex_constants::icase, and globs and expressions run over the
+ * folded name as UTF-16.
+ */
+class DirectoryFilter
+{
+private:
+  // Rules without wildcards are by far the most common. Looking them
+  // up in a hash set avoids running a regex per directory entry.
+  std::unordered_set<std::string> literals_;
+  std::vector<std::wregex> patterns_;
+
+public:
+  DirectoryFilter() = default;
+
+  /**
+   * Will throw std::regex_error if a rule fails to compile.
+   */
+  explicit DirectoryFilter(const std::vector<std::string>& rules)
+  {
+    for (const auto& rule : rules) {
+      if (rule.empty()) {
+        continue;
+      }
+      if (rule.starts_with("re:")) {
+        patterns_.emplace_back(FoldPattern(rule.substr(3)),
+                               std::regex_constants::optimize);
+      } else if (rule.find_first_of("*?") == std::string::npos) {
+        literals_.insert(FoldCase(rule));
+      } else {
+        patterns_.emplace_back(FoldPattern(GlobToRegex(rule)),
+                               std::regex_constants::optimize);
+      }
+    }
+  }
+
+  bool empty() const { return literals_.empty() && patterns_.empty(); }
+
+  // 'name' is a single folded folder name, not a full path.
+  // See FoldedString::folded_name()
+  bool Excludes(std::string_view name) const
+  {
+    if (empty()) {
+      return false;
+    }
+    if (!literals_.empty() && literals_.contains(std::string(name))) {
+      return true;
+    }
+    if (patterns_.empty()) {
+      return false;
+    }
+    const auto wide = Utf8ToWide(name);
+    for (const auto& pattern : patterns_) {
+      if (std::regex_match(wide, pattern)) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+#endif /* FINDIR_FILTER_H */
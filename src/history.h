@@ -0,0 +1,137 @@
+#ifndef FINDIR_HISTORY_H
+#define FINDIR_HISTORY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "log.h"
+
+// An entry's score halves every two weeks it isn't opened.
+const constexpr double kHistoryHalfLifeSeconds = 14 * 24 * 60 * 60.0;
+
+struct HistoryEntry
+{
+  std::string path; // UTF-8, as shown in the results list
+  double score = 0; // as of 'last_opened'
+  int64_t last_opened = 0; // seconds since the epoch
+
+  double ScoreAt(int64_t now) const
+  {
+    const auto age = static_cast<double>(now - last_opened);
+    return score * std::exp2(-std::max(age, 0.0) /
+                             kHistoryHalfLifeSeconds);
+  }
+};
+
+/**
+ * Paths the user opened from the results, ranked by frecency: every
+ * open adds one to a path's score and scores decay with age, so a
+ * folder opened daily outranks one opened often a long time ago.
+ *
+ * Kept in its own file next to the settings so that it can be saved
+ * after every open without also saving the settings. A missing or
+ * unreadable file starts an empty history. At most 'max_entries' paths
+ * are kept, the lowest ranked are forgotten first.
+ */
+class History
+{
+private:
+  std::string file_path_;
+  size_t max_entries_;
+  std::vector<HistoryEntry> entries_;
+
+public:
+  History(std::string file_path, int max_entries)
+    : file_path_(std::move(file_path))
+    , max_entries_(static_cast<size_t>(std::max(max_entries, 0)))
+  {
+    if (!std::filesystem::exists(file_path_)) {
+      return;
+    }
+    try {
+      const auto data = toml::parse(file_path_);
+      const auto items =
+        toml::find_or<std::vector<toml::value>>(data, "history", {});
+      for (const auto& item : items) {
+        entries_.push_back(HistoryEntry{
+          toml::find<std::string>(item, "path"),
+          toml::find_or<double>(item, "score", 1.0),
+          toml::find_or<int64_t>(item, "last_opened", 0) });
+      }
+    } catch (const std::exception& e) {
+      spdlog::warn("history '{}' not loaded: {}", file_path_, e.what());
+      entries_.clear();
+    }
+  }
+
+  static int64_t Now()
+  {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+  }
+
+  bool enabled() const { return max_entries_ > 0; }
+
+  void Record(const std::string& path, int64_t now)
+  {
+    if (!enabled()) {
+      return;
+    }
+    auto it = std::find_if(
+      entries_.begin(), entries_.end(), [&path](const auto& e) {
+        return e.path == path;
+      });
+    if (it != entries_.end()) {
+      it->score = it->ScoreAt(now) + 1;
+      it->last_opened = now;
+    } else {
+      entries_.push_back(HistoryEntry{ path, 1, now });
+    }
+    if (entries_.size() > max_entries_) {
+      entries_ = Ranked(now);
+      entries_.resize(max_entries_);
+    }
+  }
+
+  // Highest score first.
+  std::vector<HistoryEntry> Ranked(int64_t now) const
+  {
+    auto ranked = entries_;
+    std::stable_sort(ranked.begin(),
+                     ranked.end(),
+                     [now](const auto& a, const auto& b) {
+                       return a.ScoreAt(now) > b.ScoreAt(now);
+                     });
+    return ranked;
+  }
+
+  void Save() const
+  {
+    if (!enabled()) {
+      return;
+    }
+    toml::array items;
+    for (const auto& e : entries_) {
+      items.push_back(toml::value{ { "path", e.path },
+                                   { "score", e.score },
+                                   { "last_opened", e.last_opened } });
+    }
+    const toml::value top_table{ { "history", items } };
+
+    std::fstream file(file_path_, std::ios_base::out);
+    file << top_table << std::endl;
+    if (!file) {
+      spdlog::warn("history '{}' not saved", file_path_);
+    }
+  }
+};
+
+#endif /* FINDIR_HISTORY_H */
@@ -0,0 +1,177 @@
+#ifndef FINDIR_INDEX_H
+#define FINDIR_INDEX_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <windows.h>
+
+/**
+ * On disk layout of a directory index produced by
+ * 'find-directory-indexer.exe' and read by the search.
+ *
+ *   IndexHeader
+ *   IndexEntry[entry_count]   (depth first, pre-order)
+ *   string table              (UTF-8, not null terminated)
+ *
+ * Everything is fixed width and little endian so that a client can map
+ * the file read-only and use it in place without parsing or copying.
+ * Bump 'kIndexVersion' whenever the layout changes; clients refuse
+ * versions they don't know.
+ */
+namespace dirindex {
+
+const constexpr char kIndexMagic[4] = { 'F', 'D', 'I', 'X' };
+const constexpr uint32_t kIndexVersion = 2;
+const constexpr uint32_t kNoParent = 0xFFFFFFFF;
+
+#pragma pack(push, 1)
+struct IndexHeader
+{
+  char magic[4];
+  uint32_t version;
+  // file_time_type ticks, when the indexer started walking
+  int64_t created;
+  // 0 = unlimited, otherwise the recursion depth that was indexed
+  uint32_t max_depth;
+  uint32_t entry_count;
+  // UTF-8 root path, offsets are into the string table
+  uint32_t root_offset;
+  uint32_t root_length;
+  uint64_t entries_offset;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+};
+
+struct IndexEntry
+{
+  uint32_t parent; // entry index, kNoParent for children of the root
+  uint32_t depth;  // 1 = child of the root
+  // index one past the last descendant, lets a client skip a subtree
+  uint32_t subtree_end;
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t folded_offset; // see FoldedString
+  uint32_t folded_length;
+};
+#pragma pack(pop)
+
+/**
+ * Read-only memory mapped view of an index file.
+ * Will throw std::runtime_error if the file can't be opened or mapped,
+ * or if it isn't a valid index of a supported version.
+ */
+class IndexView
+{
+private:
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+  const char* base_ = nullptr;
+  uint64_t size_ = 0;
+  const IndexHeader* header_ = nullptr;
+  const IndexEntry* entries_ = nullptr;
+  const char* strings_ = nullptr;
+
+  void Close()
+  {
+    if (base_) {
+      UnmapViewOfFile(base_);
+    }
+    if (mapping_) {
+      CloseHandle(mapping_);
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+      CloseHandle(file_);
+    }
+  }
+
+public:
+  explicit IndexView(const std::filesystem::path& file_path)
+  {
+    // FILE_SHARE_DELETE lets the indexer replace the file while it's
+    // only open. A mapped view still blocks replacing it, so clients
+    // keep an IndexView for no longer than a search.
+    file_ = CreateFileW(file_path.c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_DELETE,
+                        nullptr,
+                        OPEN_EXISTING,
+                        FILE_FLAG_RANDOM_ACCESS,
+                        nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error("Failed to open index file.");
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size) ||
+        size.QuadPart < static_cast<LONGLONG>(sizeof(IndexHeader))) {
+      Close();
+      throw std::runtime_error("Index file is truncated.");
+    }
+    size_ = static_cast<uint64_t>(size.QuadPart);
+
+    mapping_ =
+      CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_) {
+      base_ = static_cast<const char*>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!base_) {
+      Close();
+      throw std::runtime_error("Failed to map index file.");
+    }
+
+    header_ = reinterpret_cast<const IndexHeader*>(base_);
+    const auto entries_size =
+      static_cast<uint64_t>(header_->entry_count) * sizeof(IndexEntry);
+    if (std::memcmp(header_->magic, kIndexMagic, 4) != 0 ||
+        header_->version != kIndexVersion ||
+        header_->entries_offset + entries_size > size_ ||
+        header_->strings_offset + header_->strings_size > size_ ||
+        uint64_t(header_->root_offset) + header_->root_length >
+          header_->strings_size) {
+      Close();
+      throw std::runtime_error("Not a supported index file.");
+    }
+    entries_ = reinterpret_cast<const IndexEntry*>(
+      base_ + header_->entries_offset);
+    strings_ = base_ + header_->strings_offset;
+  }
+
+  IndexView(const IndexView&) = delete;
+  IndexView& operator=(const IndexView&) = delete;
+  ~IndexView() { Close(); }
+
+  const IndexHeader& header() const { return *header_; }
+  uint32_t size() const { return header_->entry_count; }
+  const IndexEntry& operator[](uint32_t i) const { return entries_[i]; }
+
+  // Strings are not validated when the file is opened, offsets past the
+  // end of the table yield an empty view.
+  std::string_view String(uint32_t offset, uint32_t length) const
+  {
+    if (uint64_t(offset) + length > header_->strings_size) {
+      return {};
+    }
+    return std::string_view(strings_ + offset, length);
+  }
+  std::string_view root() const
+  {
+    return String(header_->root_offset, header_->root_length);
+  }
+  std::string_view name(const IndexEntry& e) const
+  {
+    return String(e.name_offset, e.name_length);
+  }
+  std::string_view folded(const IndexEntry& e) const
+  {
+    return String(e.folded_offset, e.folded_length);
+  }
+};
+
+} // namespace dirindex
+
+#endif /* FINDIR_INDEX_H */
@@ -0,0 +1,235 @@
+/**
+ *
+ * License: MIT
+ *
+ * Author: George Kuegler
+ * E-mail: georgekuegler@gmail.com
+ *
+ */
+
+// Command line tool that walks a directory tree once and writes a
+// compact index file that 'find-directory.exe' can search instead of
+// walking the tree itself. Meant to be run on a schedule against a
+// shared archive so that every user doesn't walk it separately.
+//
+// usage: find-directory-indexer.exe <root> <index file> [depth]
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+#include "index.h"
+#include "text.h"
+
+// Replacing the index is retried for a while when clients are using it.
+const constexpr int kReplaceAttempts = 30;
+const constexpr DWORD kReplaceRetryMs = 1000;
+
+class IndexBuilder
+{
+private:
+  uint32_t max_depth_;
+
+  uint32_t AddString(std::string_view s)
+  {
+    const auto offset = static_cast<uint32_t>(strings.size());
+    strings += s;
+    return offset;
+  }
+
+public:
+  std::vector<dirindex::IndexEntry> entries;
+  std::string strings;
+  size_t errors = 0;
+
+  explicit IndexBuilder(uint32_t max_depth)
+    : max_depth_(max_depth)
+  {
+  }
+
+  /**
+   * Depth first, pre-order walk. Directories that can't be read are
+   * reported and skipped. Links are not followed so that a link back
+   * up the tree can't make the walk endless. That includes junctions,
+   * which MSVC reports as file_type::junction rather than as symlinks
+   * while is_directory() follows them; like Walk() in walker.h, other
+   * reparse points (e.g. cloud placeholders) are ordinary directories.
+   */
+  void Walk(const std::filesystem::path& dir,
+            uint32_t parent,
+            uint32_t depth)
+  {
+    if (max_depth_ != 0 && depth > max_depth_) {
+      return;
+    }
+    std::error_code ec;
+    std::filesystem::directory_iterator it(dir, ec);
+    if (ec) {
+      fprintf(stderr,
+              "skipped '%s': %s\n",
+              WideToUtf8(dir.wstring()).c_str(),
+              ec.message().c_str());
+      errors++;
+      return;
+    }
+    const std::filesystem::directory_iterator end;
+    for (; it != end; it.increment(ec)) {
+      if (ec) {
+        errors++;
+        break;
+      }
+      // the type comes with the listing, so this costs no extra round
+      // trip to a network share
+      std::error_code entry_ec;
+      const auto link_type = it->symlink_status(entry_ec).type();
+      if (link_type == std::filesystem::file_type::symlink ||
+          link_type == std::filesystem::file_type::junction ||
+          !it->is_directory(entry_ec)) {
+        continue;
+      }
+      const auto name = it->path().filename().wstring();
+
+      dirindex::IndexEntry e{};
+      e.parent = parent;
+      e.depth = depth;
+      const auto text = WideToUtf8(name);
+      e.name_offset = AddString(text);
+      e.name_length = static_cast<uint32_t>(text.size());
+      const auto folded = FoldCase(std::wstring_view(name));
+      e.folded_offset = AddString(folded);
+      e.folded_length = static_cast<uint32_t>(folded.size());
+
+      const auto self = static_cast<uint32_t>(entries.size());
+      entries.push_back(e);
+      Walk(it->path(), self, depth + 1);
+      entries[self].subtree_end = static_cast<uint32_t>(entries.size());
+    }
+  }
+};
+
+int
+Usage()
+{
+  fprintf(stderr,
+          "usage: find-directory-indexer.exe <root> <index file> "
+          "[depth]\n  depth: 0 = unlimited (default)\n");
+  return 2;
+}
+
+// Digits only, so that a negative or mistyped depth isn't taken as
+// some other limit, or as unlimited.
+bool
+ParseDepth(const wchar_t* text, uint32_t& depth)
+{
+  if (!iswdigit(text[0])) {
+    return false;
+  }
+  wchar_t* end = nullptr;
+  errno = 0;
+  const auto value = wcstoul(text, &end, 10);
+  if (*end != L'\0' || errno == ERANGE ||
+      value > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  depth = static_cast<uint32_t>(value);
+  return true;
+}
+
+int
+wmain(int argc, wchar_t* argv[])
+{
+  if (argc < 3 || argc > 4) {
+    return Usage();
+  }
+  const std::filesystem::path root(argv[1]);
+  const std::filesystem::path output(argv[2]);
+  uint32_t max_depth = 0;
+  if (argc > 3 && !ParseDepth(argv[3], max_depth)) {
+    fprintf(stderr,
+            "invalid depth '%s'\n",
+            WideToUtf8(argv[3]).c_str());
+    return Usage();
+  }
+
+  // Taken before walking so that anything modified during the walk is
+  // considered newer than the index by clients.
+  using clock = std::filesystem::file_time_type::clock;
+  const auto created = clock::now().time_since_epoch().count();
+
+  IndexBuilder builder(max_depth);
+  auto root_text = FoldedString(root).text;
+  while (!root_text.empty() && root_text.back() == '/') {
+    root_text.pop_back();
+  }
+  builder.strings = root_text;
+  builder.Walk(root, dirindex::kNoParent, 1);
+
+  if (builder.entries.size() >= std::numeric_limits<uint32_t>::max() ||
+      builder.strings.size() >= std::numeric_limits<uint32_t>::max()) {
+    fprintf(stderr, "the tree is too large for the index format\n");
+    return 1;
+  }
+
+  dirindex::IndexHeader header{};
+  std::memcpy(header.magic, dirindex::kIndexMagic, 4);
+  header.version = dirindex::kIndexVersion;
+  header.created = created;
+  header.max_depth = max_depth;
+  header.entry_count = static_cast<uint32_t>(builder.entries.size());
+  header.root_offset = 0;
+  header.root_length = static_cast<uint32_t>(root_text.size());
+  header.entries_offset = sizeof(header);
+  header.strings_offset =
+    header.entries_offset +
+    builder.entries.size() * sizeof(dirindex::IndexEntry);
+  header.strings_size = builder.strings.size();
+
+  // Write next to the destination and move it into place so clients
+  // never map a half written file.
+  auto temp = output;
+  temp += L".tmp";
+  {
+    std::ofstream file(temp,
+                       std::ios_base::binary | std::ios_base::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(builder.entries.data()),
+               builder.entries.size() * sizeof(dirindex::IndexEntry));
+    file.write(builder.strings.data(), builder.strings.size());
+    if (!file) {
+      fprintf(stderr, "failed to write the index file\n");
+      return 1;
+    }
+  }
+  // A client searching the index has it mapped, which blocks
+  // replacing it until that search is done.
+  std::error_code ec;
+  for (int attempt = 0; attempt < kReplaceAttempts; attempt++) {
+    std::filesystem::rename(temp, output, ec);
+    if (!ec) {
+      break;
+    }
+    Sleep(kReplaceRetryMs);
+  }
+  if (ec) {
+    fprintf(stderr,
+            "failed to replace '%s': %s\n",
+            WideToUtf8(output.wstring()).c_str(),
+            ec.message().c_str());
+    return 1;
+  }
+
+  printf("indexed %zu directories, %zu skipped\n",
+         builder.entries.size(),
+         builder.errors);
+  return 0;
+}
@@ -1,23 +1,124 @@
 #ifndef FINDIR_LOG_H
 #define FINDIR_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// Log sites below this level are compiled out. Release builds keep
+// info and above, debug builds add debug. Define it on the command line
+// to override.
+#ifndef SPDLOG_ACTIVE_LEVEL
+#ifdef _DEBUG
 #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#else
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#endif
+#endif
+#include <spdlog/async.h>
+#include <spdlog/cfg/env.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/spdlog.h>
 
-void
+// Messages waiting for the logging thread. When the queue is full the
+// oldest message is dropped rather than blocking the thread logging.
+const constexpr size_t log_queue_size = 8192;
+
+/**
+ * One logger per subsystem so their levels can be set separately, e.g.
+ * SPDLOG_LEVEL="walk=debug,search=info" in the environment. All of
+ * them write to 'log.txt' through a single background thread, so a log
+ * call only formats the message and queues it.
+ *
+ * Until SetUpLogging() was called (it isn't in release builds) they
+ * all refer to spdlog's default logger.
+ */
+namespace logs {
+
+struct Loggers
+{
+  std::shared_ptr<spdlog::logger> walk;   // directory reads
+  std::shared_ptr<spdlog::logger> search; // matching and results
+};
+
+inline Loggers&
+GetLoggers()
+{
+  static Loggers loggers;
+  return loggers;
+}
+
+inline spdlog::logger*
+walk()
+{
+  auto& logger = GetLoggers().walk;
+  return logger ? logger.get() : spdlog::default_logger_raw();
+}
+
+inline spdlog::logger*
+search()
+{
+  auto& logger = GetLoggers().search;
+  return logger ? logger.get() : spdlog::default_logger_raw();
+}
+
+} // namespace logs
+
+/**
+ * For log sites on the search hot path (once per entry or directory):
+ * logs only the first of every 'n' calls made on each thread that get
+ * past the logger's level, so a broad search can't flood the queue.
+ * Compiled out entirely below SPDLOG_ACTIVE_LEVEL like SPDLOG_DEBUG().
+ */
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define FINDIR_DEBUG_EVERY(logger, n, ...)                             \
+  do {                                                                 \
+    auto* findir_logger_ = (logger);                                   \
+    if (findir_logger_->should_log(spdlog::level::debug)) {            \
+      static thread_local uint64_t findir_calls_ = 0;                  \
+      if (findir_calls_++ % (n) == 0) {                                \
+        SPDLOG_LOGGER_DEBUG(findir_logger_, __VA_ARGS__);              \
+      }                                                                \
+    }                                                                  \
+  } while (0)
+#else
+#define FINDIR_DEBUG_EVERY(logger, n, ...) (void)0
+#endif
+
+inline void
 SetUpLogging()
 {
-  auto logger = spdlog::basic_logger_mt("main", "log.txt", true);
-  logger->set_level(spdlog::level::trace);
-  spdlog::set_default_logger(std::move(logger));
+  spdlog::init_thread_pool(log_queue_size, 1);
+  auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(
+    "log.txt", true);
+  auto make_logger = [&sink](const char* name) {
+    auto logger = std::make_shared<spdlog::async_logger>(
+      name,
+      sink,
+      spdlog::thread_pool(),
+      spdlog::async_overflow_policy::overrun_oldest);
+    logger->set_level(spdlog::level::trace);
+    spdlog::register_logger(logger);
+    return logger;
+  };
+  spdlog::set_default_logger(make_logger("main"));
+  logs::GetLoggers().walk = make_logger("walk");
+  logs::GetLoggers().search = make_logger("search");
+  // per logger levels from SPDLOG_LEVEL, if set
+  spdlog::cfg::load_env_levels();
   spdlog::flush_every(std::chrono::seconds(1));
   spdlog::info("----- start of log file ------");
 }
 
-void
+// Writes out everything still queued and stops the logging thread.
+inline void
 FlushLogging()
 {
-  spdlog::get("main")->flush();
+  spdlog::apply_all([](std::shared_ptr<spdlog::logger> logger) {
+    logger->flush();
+  });
+  spdlog::shutdown();
 }
 
 #endif /* FINDIR_LOG_H */
@@ -16,9 +16,13 @@
 #pragma comment(lib, "Rpcrt4")
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <filesystem>
 #include <future>
+#include <memory>
+#include <thread>
+#include <unordered_map>
 #include <regex>
 
 // wxWidgets is full of non-secure strcpy
@@ -39,14 +43,45 @@
 #include <windows.h>
 
 #include "config.h"
+#include "engine.h"
+#include "history.h"
 #include "log.h"
+#include "match.h"
+#include "ring.h"
+#include "search.h"
 #include "shell.h"
+#include "snapshot.h"
+#include "text.h"
+#include "trace.h"
 #include "types.h"
 
 const wxString MY_APP_VERSION_STRING = "1.3";
 const wxString MY_APP_DATE = __DATE__;
 const constexpr int default_app_width = 550;
 const constexpr int default_app_height = 800;
+// The results list is refreshed at a fixed rate while searching rather
+// than once per match.
+const constexpr int result_flush_interval_ms = 33;
+const constexpr size_t result_flush_limit = 2048;
+const constexpr size_t result_ring_capacity = 8192;
+const constexpr int ID_SAVE_SNAPSHOT = wxID_HIGHEST + 1;
+
+// Outcome of saving or comparing a snapshot on the engine's threads,
+// posted back to the GUI. See Frame::RunSnapshotTask().
+struct SnapshotOutcome
+{
+  int search = 0; // the search it belongs to, see 'search_count_'
+  std::string error;
+  snapshot::Comparison comparison;
+};
+
+// Entries of the result filter, see Frame::OnFilter().
+enum result_filter_choice
+{
+  filter_all,
+  filter_added,
+  filter_removed
+};
 
 wxPoint
 GetOrigin(const int w, const int h)
@@ -57,8 +92,8 @@ GetOrigin(const int w, const int h)
                  (desktop_height / 2) - (h / 2));
 }
 
-// requirement: type T<S> must be an iterable container where S can be
-// implicitly converted to a wxString.
+// requirement: type T<S> must be an iterable container of UTF-8
+// encoded std::string.
 // This function is a bit inefficient, but it's typically only used at
 // startup.
 template<typename T>
@@ -67,51 +102,13 @@ BuildWxArrayString(const T container)
 {
   wxArrayString array;
   for (const auto& text : container) {
-    array.Add(wxString(text), 1); // 2nd param (1) is number_of_copies
+    // 2nd param (1) is number_of_copies
+    array.Add(wxString::FromUTF8(text), 1);
   }
   return array;
 }
 
-Strings
-GetFilePaths(std::string base_path, int depth)
-{
-  if (depth == 0) {
-    return {}; // return empty if depth exhausted
-  }
-  Strings p;
-  for (auto const& entry :
-       std::filesystem::directory_iterator{ base_path }) {
-    if (entry.is_directory()) {
-      auto folder = entry.path().generic_string();
-      p.push_back(folder);
-      // use recursion
-      auto paths = GetFilePaths(folder, depth - 1);
-      p.insert(p.end(), paths.begin(), paths.end());
-    }
-  }
-  return p;
-}
-
-std::string
-EscapeForRegularExpression(const std::string& s)
-{
-  // Not all special regex characters are escaped
-  // missing: [], ?, |
-  // seems to have trouble escaping the []
-  const std::regex metacharacters("[\.\$\^\{\}\(\)\?\*\+\-]");
-  try {
-    return std::regex_replace(s, metacharacters, "\\$&");
-  } catch (std::regex_error error) {
-    // logging is thread safe as 2009
-    // https://wxwidgets.blogspot.com/2009/07/blogging-about-logging.html
-    wxLogError(error.what());
-    return "";
-  }
-}
-
-class Frame
-  : public wxFrame
-  , public wxThreadHelper
+class Frame : public wxFrame
 {
 private:
   wxComboBox* directory_path_entry;
@@ -120,8 +117,11 @@ private:
   wxCheckBox* recursive_checkbox;
   wxCheckBox* text_match_checkbox;
   wxListView* search_results;
+  wxStaticText* recent_label;
+  wxListView* recent_results;
   wxButton* search_button;
   wxStaticText* results_counter_label;
+  wxChoice* result_filter;
   // FUTURE: wheel control to show progress on long searches.
   // wxActivityIndicator* activity_indicator;
 
@@ -130,17 +130,61 @@ private:
   std::string search_pattern_;
   std::string search_directory_;
   std::shared_ptr<config::Settings> settings;
+  std::unique_ptr<History> history_;
+  // Recently opened paths shown when the search started that the
+  // search hasn't found yet, mapped to their item in 'recent_results'.
+  // Keyed by the folded path: the search reports paths in the case of
+  // the root as typed, or of the index, not of the history.
+  std::unordered_map<std::string, long> unconfirmed_recent_;
 
   int search_results_index;
 
+  // Every match of the last search, kept to save as a snapshot and to
+  // show again after showing its differences from the saved one.
+  // Shared with snapshot tasks, so a new search starts a new list
+  // rather than changing this one.
+  std::shared_ptr<Strings> results_ = std::make_shared<Strings>();
+  SearchStats last_stats_;
+  int search_count_ = 0;
+  // Identifies the search (root, pattern, mode, depth) and so its
+  // snapshot file; empty unless the last search ran to completion.
+  std::string search_description_;
+  std::string snapshot_description_;
+  // differences from the saved snapshot, computed on first use
+  bool diff_ready_ = false;
+  snapshot::Comparison diff_;
+  // Saving and comparing snapshots runs on the engine, one at a time.
+  // Like the search, the task is waited for before the frame goes
+  // away.
+  bool snapshot_busy_ = false;
+  std::future<void> snapshot_task_;
+
+  // Matches travel from the search thread to the GUI through a lock-free
+  // ring which the GUI drains on a timer. See UpdateResult().
+  SpscRing<std::string, result_ring_capacity> results_ring_;
+  wxTimer flush_timer_;
+
+  // Searches run on the application's engine. Its callbacks use
+  // members of this instance, so a search must be waited for before
+  // the frame goes away. 'cancel_search_' stops a callback blocked on
+  // a full ring.
+  SearchEngine& engine_;
+  SearchHandle search_;
+  std::atomic<bool> cancel_search_ = false;
+  // From starting a search until its message_code::search_finished was
+  // handled, which is later than the handle reports it done.
+  bool searching_ = false;
+
 public:
-  Frame(const wxString& default_ptrn,
+  Frame(SearchEngine& engine,
+        const wxString& default_ptrn,
         const wxString& default_search_folder)
     : wxFrame(nullptr,
               wxID_ANY,
               "Find Directory With Regex",
               GetOrigin(default_app_width, default_app_height),
               wxSize(default_app_width, default_app_height))
+    , engine_(engine)
   {
 
     //////////////////////////////////////////////////////////////////////
@@ -148,6 +192,11 @@ public:
     //////////////////////////////////////////////////////////////////////
     wxMenu* menu_file = new wxMenu;
     menu_file->Append(wxID_SAVE, "Save\tCtrl-s", "Save settings.");
+    menu_file->Append(
+      ID_SAVE_SNAPSHOT,
+      "Save Snapshot",
+      "Save this search's matches to compare later runs of the same "
+      "search to.");
     menu_file->AppendSeparator();
     menu_file->Append(wxID_EXIT);
 
@@ -186,6 +235,8 @@ public:
 
     // TODO: what happens if this fails?
     settings = std::make_shared<config::Settings>(result.settings);
+    history_ = std::make_unique<History>(
+      GetFullPath(settings->history_file), settings->max_history);
 
     auto bookmarks =
       BuildWxArrayString<std::set<std::string>>(settings->bookmarks);
@@ -211,7 +262,8 @@ public:
       panel,
       wxID_ANY,
       !default_search_folder.empty() ? default_search_folder
-                                     : settings->default_search_path,
+                                     : wxString::FromUTF8(
+                                         settings->default_search_path),
       wxDefaultPosition,
       wxDefaultSize,
       bookmarks,
@@ -230,8 +282,26 @@ public:
                                      int_depth_validator);
     search_button = new wxButton(panel, wxID_ANY, "Search");
     results_counter_label = new wxStaticText(panel, wxID_ANY, "");
+    const wxString filter_choices[] = { "all results",
+                                        "added since snapshot",
+                                        "removed since snapshot" };
+    result_filter = new wxChoice(panel,
+                                 wxID_ANY,
+                                 wxDefaultPosition,
+                                 wxDefaultSize,
+                                 3,
+                                 filter_choices);
+    result_filter->SetSelection(filter_all);
+    result_filter->SetToolTip(
+      "Compares this search's matches with those saved in its "
+      "snapshot. Only matches are saved and compared, not every folder "
+      "below the search folder.");
     search_results = new wxListView(
       panel, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_LIST);
+    recent_label =
+      new wxStaticText(panel, wxID_ANY, "recently opened:");
+    recent_results = new wxListView(
+      panel, wxID_ANY, wxDefaultPosition, wxSize(-1, 90), wxLC_LIST);
 
     // Set default values
     text_match_checkbox->SetValue(settings->use_text);
@@ -257,9 +327,18 @@ public:
     top->Add(directory_path_entry, 0, wxEXPAND | wxALL, 5);
     top->Add(controls, 0, wxEXPAND | wxALL, 5);
     top->Add(search_button, 0, wxEXPAND | wxALL, 5);
-    top->Add(results_counter_label, 0, wxEXPAND | wxLEFT, 5);
+    auto results_header = new wxBoxSizer(wxHORIZONTAL);
+    results_header->Add(
+      results_counter_label, 1, wxALIGN_CENTER_VERTICAL | wxRIGHT, 5);
+    results_header->Add(result_filter, 0, wxALIGN_CENTER_VERTICAL);
+    top->Add(results_header, 0, wxEXPAND | wxLEFT | wxRIGHT, 5);
+    top->Add(recent_label, 0, wxLEFT | wxRIGHT | wxTOP, 5);
+    top->Add(recent_results, 0, wxEXPAND | wxALL, 5);
     top->Add(search_results, 1, wxEXPAND | wxALL, 5);
     panel->SetSizer(top);
+    recent_label->Hide();
+    recent_results->Hide();
+    result_filter->Hide();
 
     // Bind Keyboard Shortcuts
     wxAcceleratorEntry k1(wxACCEL_CTRL, WXK_CONTROL_S, wxID_SAVE);
@@ -268,6 +347,10 @@ public:
     // Bind Events
     Bind(wxEVT_COMMAND_MENU_SELECTED, &Frame::OnClose, this, wxID_EXIT);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &Frame::OnSave, this, wxID_SAVE);
+    Bind(wxEVT_COMMAND_MENU_SELECTED,
+         &Frame::OnSaveSnapshot,
+         this,
+         ID_SAVE_SNAPSHOT);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &Frame::OnHelp, this, wxID_HELP);
     Bind(wxEVT_COMMAND_MENU_SELECTED, &Frame::OnEdit, this, wxID_EDIT);
     Bind(
@@ -278,33 +361,103 @@ public:
       wxEVT_TEXT_ENTER, &Frame::OnSearch, this);
     search_results->Bind(
       wxEVT_LIST_ITEM_SELECTED, &Frame::OnItem, this);
+    recent_results->Bind(
+      wxEVT_LIST_ITEM_SELECTED, &Frame::OnItem, this);
+    result_filter->Bind(wxEVT_CHOICE, &Frame::OnFilter, this);
 
     // Handle and display messages to text control widget sent from
     // outside GUI thread
+    // In testing, matches were found (even on a network drive) much
+    // faster that the list was being updated. Posting an event per match
+    // made a queue of update messages pile up until the end, making the
+    // overall task slower. Instead the list is refreshed from the ring
+    // at a fixed frame rate while a search is running.
+    flush_timer_.SetOwner(this);
+    Bind(wxEVT_TIMER, [this](wxTimerEvent&) { FlushResults(); });
+
     Bind(wxEVT_THREAD, [this](wxThreadEvent& event) {
       switch (event.GetInt()) {
-        case message_code::search_result:
-          search_results->InsertItem(search_results_index++,
-                                     event.GetString());
-          // In testing, matches were found (even on a network drive)
-          // much faster that the list was being updated. I could never
-          // get the list to update as matches were found (as does
-          // grepWin does). A queue of update messages would pile up
-          // until the end making the overall task slower.
-          // search_results->UpdateWindowUI();
+        case message_code::search_finished: {
+          if (event.GetExtraLong() != search_count_) {
+            break; // of a search before the current one
+          }
+          searching_ = false;
+          // everything was pushed before this event was posted
+          flush_timer_.Stop();
+          FlushResults(result_ring_capacity);
+          search_button->SetLabel("Search");
+          search_button->Enable();
+          const auto stats = event.GetPayload<SearchStats>();
+          last_stats_ = stats;
+          ShowSummary(stats);
+          FinishRecent(stats);
+          // only a complete result set can be compared or saved
+          if (stats.error.empty() && !stats.cancelled &&
+              !stats.result_limit_reached &&
+              stats.directories_skipped == 0) {
+            snapshot_description_ = search_description_;
+          }
+          ShowFilter();
+          if (!stats.error.empty()) {
+            wxLogError("%s", stats.error);
+          } else {
+            // add searchpath to dropdown
+            settings->AddBookmark(search_directory_);
+            // settings->Save();  // I do not want to save settings
+          }
+          if (trace::Enabled()) {
+            // written next to log.txt
+            if (!trace::Stop("trace.json")) {
+              wxLogError("Failed to write the trace 'trace.json'.");
+            }
+          }
           break;
-        case message_code::search_lump_results:
-          for (auto& item : event.GetPayload<Strings>()) {
-            search_results->InsertItem(search_results_index++, item);
+        }
+        case message_code::snapshot_saved: {
+          snapshot_busy_ = false;
+          result_filter->Enable();
+          const auto outcome =
+            event.GetPayload<std::shared_ptr<SnapshotOutcome>>();
+          if (!outcome->error.empty()) {
+            wxLogError("Failed to save the snapshot: %s",
+                       wxString::FromUTF8(outcome->error));
+            break;
+          }
+          if (outcome->search != search_count_) {
+            break; // a search started since
+          }
+          // later comparisons are against the new snapshot
+          ResetDiff();
+          if (result_filter->GetSelection() != filter_all) {
+            result_filter->SetSelection(filter_all);
+            ShowPaths(*results_);
           }
+          ShowSummary(last_stats_);
+          results_counter_label->SetLabel(
+            results_counter_label->GetLabel() + ", snapshot saved");
+          ShowFilter();
           break;
-        case message_code::search_finished:
-          search_button->SetLabel("Search");
-          auto label = wxString::Format(wxT("%i matches found"),
-                                        search_results_index);
-          results_counter_label->SetLabel(label);
-          results_counter_label->Show();
+        }
+        case message_code::snapshot_compared: {
+          snapshot_busy_ = false;
+          result_filter->Enable();
+          const auto outcome =
+            event.GetPayload<std::shared_ptr<SnapshotOutcome>>();
+          if (outcome->search != search_count_) {
+            break; // a search started since
+          }
+          if (!outcome->error.empty()) {
+            wxLogError("Couldn't read the snapshot: %s",
+                       wxString::FromUTF8(outcome->error));
+            result_filter->SetSelection(filter_all);
+            ShowSummary(last_stats_);
+            break;
+          }
+          diff_ = std::move(outcome->comparison);
+          diff_ready_ = true;
+          ShowDiff(result_filter->GetSelection());
           break;
+        }
       }
     });
 
@@ -317,214 +470,345 @@ public:
     }
   }
 
-  void UpdateResult(std::string result)
+  void ShowSummary(const SearchStats& stats)
   {
-    wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
-    event->SetInt(message_code::search_result);
-    event->SetString(result);
-    this->QueueEvent(event);
-    // VERY IMPORTANT: do not call any GUI function inside this thread,
-    // rather use wxQueueEvent(). We used pointer 'this' assuming it's
-    // safe; see OnClose()
+    auto label = wxString::Format(wxT("%i matches found"),
+                                  search_results_index);
+    if (stats.result_limit_reached) {
+      label += wxT(" (limit reached, search stopped)");
+    }
+    if (stats.directories_pruned) {
+      label += wxString::Format(wxT(", %i directories pruned"),
+                                stats.directories_pruned);
+    }
+    if (stats.duplicates_skipped) {
+      label += wxString::Format(wxT(", %i duplicates skipped"),
+                                stats.duplicates_skipped);
+    }
+    // Unreadable directories don't stop the search. Say how many were
+    // left out and why; hovering the label lists them.
+    wxString tooltip;
+    if (stats.directories_skipped) {
+      label += wxString::Format(wxT(", %i unreadable skipped ("),
+                                stats.directories_skipped);
+      bool first = true;
+      for (const auto& [reason, count] : stats.skip_reasons) {
+        label += wxString::Format(
+          wxT("%s%s: %i"), first ? "" : ", ", wxString(reason), count);
+        first = false;
+      }
+      label += ")";
+
+      for (const auto& skipped : stats.skipped) {
+        tooltip += wxString::FromUTF8(skipped.path) + " - " +
+                   wxString(skipped.reason) + "\n";
+      }
+      const int unlisted = stats.directories_skipped -
+                           static_cast<int>(stats.skipped.size());
+      if (unlisted > 0) {
+        tooltip += wxString::Format(wxT("... and %i more"), unlisted);
+      }
+    }
+    results_counter_label->SetLabel(label);
+    results_counter_label->SetToolTip(tooltip);
+    results_counter_label->Show();
   }
 
-  wxThread::ExitCode Entry()
+  // GUI thread only. Move at most 'limit' matches from the ring into
+  // the results list.
+  void FlushResults(size_t limit = result_flush_limit)
   {
-    const auto use_text = settings->use_text;
-    const auto use_recursion = settings->use_recursion;
-    const auto recursion_depth = settings->recursion_depth;
-
-    if (use_text) {
-      search_pattern_ = EscapeForRegularExpression(search_pattern_);
+    if (results_ring_.empty()) {
+      return;
     }
-
-    // TODO: put the search call or iterator behind a function or
-    // something or co_func so that way i can have a single search loop
-    // or multiple loops for the different generators and a single
-    // function call
-
-    // Check to see if the path exists with a timeout
-    std::future<bool> future = std::async(
-      [](std::filesystem::path sd) {
-        return std::filesystem::exists(sd);
+    trace::Span span("ui flush");
+    search_results->Freeze();
+    const auto n = results_ring_.Drain(
+      [this](std::string&& item) {
+        ConfirmRecent(item);
+        search_results->InsertItem(search_results_index++,
+                                   wxString::FromUTF8(item));
+        results_->push_back(std::move(item));
       },
-      std::filesystem::path(search_directory_));
-
-    SPDLOG_DEBUG("checking, please wait");
-
-    if (future.wait_for(std::chrono::milliseconds(1000)) ==
-        std::future_status::ready) {
-      if (future.get()) {
-        SPDLOG_DEBUG("The path does exist.");
-      } else {
-        wxLogError("The path does not exist.");
-        wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
-        event->SetInt(message_code::search_finished);
-        this->QueueEvent(event);
-        return static_cast<wxThread::ExitCode>(0);
-      }
-    } else {
-      wxLogError("Couldn't access the path in a reasonable amount of "
-                 "time.\nIt may be in-accessible or not exist.");
-      wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
-      event->SetInt(message_code::search_finished);
-      this->QueueEvent(event);
-      return static_cast<wxThread::ExitCode>(0);
+      limit);
+    search_results->Thaw();
+    if (trace::Enabled()) {
+      span.SetArg(std::to_string(n) + " results");
     }
+  }
 
-    try {
-      if (use_recursion &&
-          recursion_depth == 0) { // 0 == unrestricted depth
-        std::regex r(search_pattern_, std::regex_constants::icase);
-        std::smatch m;
-        for (auto const& entry :
-             std::filesystem::recursive_directory_iterator{
-               search_directory_ }) {
-          if (GetThread()->TestDestroy()) { // this is so ugly
-            break;
-          }
-          std::string path = entry.path().generic_string();
-          if (std::regex_search(path, m, r)) {
-            SPDLOG_DEBUG("path found: {}", path);
-            UpdateResult(
-              path); // push a single match to the results list
-          }
-        }
-      } else if (use_recursion && recursion_depth > 1) {
-        // a depth of (1) is the same as using no recursion therefore it
-        // is handled in the else
-        Strings matches;
-        auto all_paths =
-          GetFilePaths(search_directory_, recursion_depth);
-        std::regex r(search_pattern_, std::regex_constants::icase);
-        std::smatch m;
-        for (auto const& path : all_paths) {
-          if (GetThread()->TestDestroy()) {
-            break;
-          }
-          if (std::regex_search(path, m, r)) {
-            SPDLOG_DEBUG("path found: {}", path);
-            matches.push_back(path);
-          }
-        }
-        // lump matches into a single message as an optimization
-        wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
-        event->SetInt(message_code::search_lump_results);
-        event->SetPayload<Strings>(matches);
-        this->QueueEvent(event);
-      } else {
-        // no recursion, only search the folder names in the
-        // directory
-        std::regex r(search_pattern_, std::regex_constants::icase);
-        std::smatch m;
-        for (auto const& entry :
-             std::filesystem::directory_iterator{ search_directory_ }) {
-          if (GetThread()->TestDestroy()) {
-            break;
+  /**
+   * GUI thread only. List the recently opened paths that the search
+   * that is about to start should find, before it has read anything.
+   * They are greyed out until the search finds them.
+   */
+  void ShowRecent()
+  {
+    recent_results->DeleteAllItems();
+    unconfirmed_recent_.clear();
+    if (history_->enabled()) {
+      try {
+        const Matcher matcher(search_pattern_, settings->use_text);
+        // only paths the search can reach: below the search path and
+        // no deeper than the search goes (0 = unlimited)
+        const auto root =
+          TrimSeparator(FoldedString(PathFromUtf8(search_directory_))
+                          .folded) +
+          '/';
+        const int depth =
+          settings->use_recursion ? settings->recursion_depth : 1;
+        for (const auto& entry : history_->Ranked(History::Now())) {
+          const FoldedString path(PathFromUtf8(entry.path));
+          if (!path.folded.starts_with(root)) {
+            continue;
           }
-          std::string path = entry.path().generic_string();
-          if (std::regex_search(path, m, r)) {
-            SPDLOG_DEBUG("path found: {}", path);
-            UpdateResult(
-              path); // push a single match to the results list
+          const auto levels =
+            std::count(path.folded.begin() + root.size(),
+                       path.folded.end(),
+                       '/') +
+            1;
+          if ((depth > 0 && levels > depth) ||
+              !matcher.Matches(path.folded)) {
+            continue;
           }
+          const auto item =
+            recent_results->InsertItem(recent_results->GetItemCount(),
+                                       wxString::FromUTF8(path.text));
+          recent_results->SetItemTextColour(
+            item, wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT));
+          unconfirmed_recent_.emplace(path.folded, item);
         }
+      } catch (const std::regex_error&) {
+        // reported by the search itself
       }
-      // add searchpath to dropdown
-      settings->AddBookmark(search_directory_);
-      // settings->Save();  // I do not want to save settings
-
-    } catch (std::filesystem::filesystem_error& e) {
-      // logging is thread safe as 2009
-      // https://wxwidgets.blogspot.com/2009/07/blogging-about-logging.html
-      wxLogError("%s", e.what());
-    } catch (std::regex_error& e) {
-      wxLogError("%s", e.what());
     }
-    // post a search_finished message to my frame when complete
+    const bool any = recent_results->GetItemCount() > 0;
+    recent_label->Show(any);
+    recent_results->Show(any);
+    recent_results->GetParent()->Layout();
+  }
+
+  // GUI thread only. The search found a recently opened path.
+  void ConfirmRecent(const std::string& path)
+  {
+    if (unconfirmed_recent_.empty()) {
+      return;
+    }
+    auto it =
+      unconfirmed_recent_.find(FoldCase(std::string_view(path)));
+    if (it != unconfirmed_recent_.end()) {
+      recent_results->SetItemTextColour(
+        it->second,
+        wxSystemSettings::GetColour(wxSYS_COLOUR_LISTBOXTEXT));
+      unconfirmed_recent_.erase(it);
+    }
+  }
+
+  /**
+   * GUI thread only. Recently opened paths that a complete search
+   * didn't find no longer exist or no longer match; remove them. After
+   * an incomplete or failed search, or one answered from an index that
+   * may predate them, they stay, still greyed out.
+   */
+  void FinishRecent(const SearchStats& stats)
+  {
+    if (!stats.error.empty() || stats.answered_from_index ||
+        stats.cancelled || stats.result_limit_reached ||
+        stats.directories_skipped > 0 || unconfirmed_recent_.empty()) {
+      return;
+    }
+    std::vector<long> items;
+    for (const auto& [path, item] : unconfirmed_recent_) {
+      items.push_back(item);
+    }
+    unconfirmed_recent_.clear();
+    // from the bottom up so the remaining indexes stay valid
+    std::sort(items.rbegin(), items.rend());
+    for (const auto item : items) {
+      recent_results->DeleteItem(item);
+    }
+    if (recent_results->GetItemCount() == 0) {
+      recent_label->Hide();
+      recent_results->Hide();
+      recent_results->GetParent()->Layout();
+    }
+  }
+
+  // Search thread only. Blocks while the ring is full, which slows the
+  // search down to the rate the GUI can display results instead of
+  // letting them pile up on the heap.
+  void UpdateResult(std::string result)
+  {
+    while (!results_ring_.TryPush(result)) {
+      if (cancel_search_.load()) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // VERY IMPORTANT: do not call any GUI function inside this thread,
+    // rather use the ring or wxQueueEvent(). We used pointer 'this'
+    // assuming it's safe; see OnClose()
+  }
+
+  // 'search' is the search's 'search_count_'.
+  void PostSearchFinished(int search, const SearchStats& stats)
+  {
     wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
     event->SetInt(message_code::search_finished);
+    event->SetExtraLong(search);
+    event->SetPayload<SearchStats>(stats);
     this->QueueEvent(event);
-    return static_cast<wxThread::ExitCode>(0);
   }
 
+  ~Frame() { WaitForSearch(); }
+
+  // Cancels a running search and waits for it, and for a snapshot
+  // task, to finish.
+  void WaitForSearch()
+  {
+    cancel_search_ = true;
+    search_.Cancel();
+    search_.Wait();
+    if (snapshot_task_.valid()) {
+      snapshot_task_.wait();
+    }
+  }
+
+  bool Searching() const { return searching_; }
+
   void OnSearch(const wxCommandEvent&)
   {
     // TODO: ping server availability before searching
     // also a stop button!
-    // start a new search if thread not already searching
-    if (!GetThread() || !(GetThread()->IsRunning())) {
+    // start a new search if not already searching
+    if (!Searching()) {
       results_counter_label->SetLabel("searching...");
       search_results->DeleteAllItems();
       search_results_index = 0;
+      results_ = std::make_shared<Strings>();
+      search_count_++;
+      snapshot_description_.clear();
+      ResetDiff();
+      result_filter->SetSelection(filter_all);
+      result_filter->Hide();
+      // discard anything left over from a cancelled search
+      results_ring_.Drain([](std::string&&) {});
       SPDLOG_DEBUG("on search is entering");
+      if (settings->trace_searches) {
+        trace::Start();
+        trace::NameThread("gui");
+      }
 
       // get user data from panel widgets for thread
+      // kept as UTF-8, the search thread folds and converts them
       search_pattern_ =
-        std::string(regex_pattern_entry->GetLineText(0).mb_str());
+        std::string(regex_pattern_entry->GetLineText(0).ToUTF8());
       search_directory_ =
-        std::string(directory_path_entry->GetValue().mb_str());
+        std::string(directory_path_entry->GetValue().ToUTF8());
+      // answered from the history before the walk reads anything
+      ShowRecent();
+      // the same folder however it was typed
+      search_description_ =
+        TrimSeparator(
+          FoldedString(PathFromUtf8(search_directory_)).folded) +
+        '\n' + search_pattern_ + '\n' +
+        (settings->use_text ? "text" : "regex") + '\n' +
+        std::to_string(
+          settings->use_recursion ? settings->recursion_depth : 1);
 
       /**
        * - gui does a bunch of set up work
-       * - gui launches a thread
-       * - every time a directory matches, a message is sent to the GUI
-       * with the file path.
-       * - once thread completes work, a final finish msg is sent to the
-       * gui
-       *
-       * does the gui need to be able to cancel the thread?
+       * - gui starts a search on the engine
+       * - every batch of matches is pushed to the ring the gui drains
+       * on a timer
+       * - once the search completes work, a final finish msg is sent to
+       * the gui
        */
 
       // We want to start a long task, but we don't want our GUI to
-      // block while it's executed, so we use a thread to do it. Use the
-      // thread specified in the thread helper.
-      if (CreateThread(wxTHREAD_JOINABLE) != wxTHREAD_NO_ERROR) {
-        wxLogError("Could not create the worker thread!");
-        return;
-      }
-      if (GetThread()->Run() != wxTHREAD_NO_ERROR) {
-        wxLogError("Could not run the worker thread!");
-        return;
-      }
-
-      // after the thread is successfully running, now I can notify the
-      // user that things are happening
+      // block while it's executed. The engine runs it on its own
+      // threads, which are started once rather than per search.
+      SearchQuery query;
+      query.root = search_directory_;
+      query.pattern = search_pattern_;
+      query.mode =
+        settings->use_text ? MatchMode::text : MatchMode::regex;
+      // a depth of (1) is the same as using no recursion
+      query.depth =
+        settings->use_recursion ? settings->recursion_depth : 1;
+      query.limits.max_results = settings->max_results;
+      query.limits.min_concurrent_reads =
+        settings->min_concurrent_reads;
+      query.limits.max_concurrent_reads =
+        settings->max_concurrent_reads;
+      query.limits.max_tracked_directories =
+        settings->max_tracked_directories;
+      query.exclude_directories = settings->exclude_directories;
+      query.index_file = settings->index_file;
+
+      cancel_search_ = false;
+      searching_ = true;
+      search_ = engine_.Start(
+        std::move(query),
+        { [this](Strings&& batch) {
+           for (auto& result : batch) {
+             UpdateResult(std::move(result));
+           }
+         },
+          [this, search = search_count_](const SearchStats& stats) {
+            PostSearchFinished(search, stats);
+          } });
+
+      // now I can notify the user that things are happening
       search_button->SetLabel("Stop");
+      flush_timer_.Start(result_flush_interval_ms);
       // launch widgets to display searching
-    } else { // the thread is running so I must stop the current search
-      search_button->SetLabel("Search");
-      GetThread()->Delete();
+    } else if (!cancel_search_) {
+      // a search is running so I must stop it. It keeps running until
+      // it notices; a new one can only start after it finished, see
+      // message_code::search_finished.
+      search_button->SetLabel("Stopping...");
+      search_button->Disable();
+      cancel_search_ = true;
+      search_.Cancel();
     }
   }
 
   void OnItem(wxListEvent& event)
   {
+    // removed folders are gone, there is nothing to open
+    if (event.GetEventObject() == search_results &&
+        result_filter->GetSelection() == filter_removed) {
+      return;
+    }
     // get path from list box selection
-    auto path = std::string(event.GetItem().GetText().mb_str());
+    // Use the wide string so that non-ANSI folder names survive the
+    // trip to explorer.
+    auto path = event.GetItem().GetText().ToStdWstring();
+    const auto path_text = WideToUtf8(path);
     // test string
     // std::string path = "L:\\C24-11 Dunkin, 103-105 Elm Street, New
     // Canaan";
 
     // path library returns '/' in pathnames
-    // windows CreateProcessA call does not accept '/' on cmd line, they
+    // windows CreateProcess call does not accept '/' on cmd line, they
     // are interpreted as switches
-    std::replace(path.begin(), path.end(), '/', '\\');
+    std::replace(path.begin(), path.end(), L'/', L'\\');
 
-    STARTUPINFOA start_up_info;
+    STARTUPINFOW start_up_info;
     ZeroMemory(&start_up_info, sizeof(start_up_info));
-    start_up_info.cb = sizeof(STARTUPINFOA);
+    start_up_info.cb = sizeof(STARTUPINFOW);
 
     // out structure from create process call
     PROCESS_INFORMATION process_info;
 
     auto cmd =
-      std::string("explorer.exe \"") + path + std::string("\"");
-    SPDLOG_DEBUG("cmd string: {}", cmd);
+      std::wstring(L"explorer.exe \"") + path + std::wstring(L"\"");
+    SPDLOG_DEBUG("cmd string: {}", WideToUtf8(cmd));
 
     BOOL result =
-      CreateProcessA(nullptr,
-                     const_cast<char*>(cmd.c_str()),
+      CreateProcessW(nullptr,
+                     cmd.data(),
                      nullptr,          // process attributes
                      nullptr,          // thread attributes
                      FALSE,            // don't inherit handles
@@ -546,6 +830,9 @@ public:
                  GetLastError());
       return;
     }
+    // saved right away, the app may close below
+    history_->Record(path_text, History::Now());
+    history_->Save();
     if (settings->exit_on_search) {
       Close(true);
     }
@@ -560,16 +847,139 @@ public:
     settings->Save();
   }
 
+  std::filesystem::path SnapshotPath() const
+  {
+    return PathFromUtf8(GetFullPath(settings->snapshot_directory)) /
+           snapshot::FileName(snapshot_description_);
+  }
+
+  void ResetDiff()
+  {
+    diff_ready_ = false;
+    diff_ = {};
+  }
+
+  // GUI thread only. The filter is offered once a complete search has
+  // a saved snapshot to compare against.
+  void ShowFilter()
+  {
+    std::error_code ec;
+    const bool show = !snapshot_description_.empty() &&
+                      std::filesystem::exists(SnapshotPath(), ec);
+    result_filter->Show(show);
+    result_filter->GetParent()->Layout();
+  }
+
+  void ShowPaths(const Strings& paths)
+  {
+    search_results->Freeze();
+    search_results->DeleteAllItems();
+    long index = 0;
+    for (const auto& path : paths) {
+      search_results->InsertItem(index++, wxString::FromUTF8(path));
+    }
+    search_results->Thaw();
+  }
+
+  /**
+   * GUI thread only. Runs 'work' on the engine and posts its outcome
+   * back as an event with 'code'. An exception from 'work' is reported
+   * as the outcome's error. 'work' runs while the GUI goes on, so it
+   * must not use members of this instance.
+   */
+  void RunSnapshotTask(int code,
+                       std::function<void(SnapshotOutcome&)> work)
+  {
+    snapshot_busy_ = true;
+    result_filter->Disable();
+    auto outcome = std::make_shared<SnapshotOutcome>();
+    outcome->search = search_count_;
+    snapshot_task_ = engine_.Submit(
+      [this, code, outcome, work = std::move(work)]() {
+        try {
+          work(*outcome);
+        } catch (const std::exception& e) {
+          outcome->error = e.what();
+        }
+        wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD);
+        event->SetInt(code);
+        event->SetPayload(outcome);
+        this->QueueEvent(event);
+      });
+  }
+
+  void ShowDiff(int choice)
+  {
+    const auto& paths =
+      choice == filter_added ? diff_.added : diff_.removed;
+    ShowPaths(paths);
+    const auto taken = wxDateTime(static_cast<time_t>(diff_.created));
+    results_counter_label->SetLabel(
+      wxString::Format(wxT("%i %s since the snapshot of %s"),
+                       static_cast<int>(paths.size()),
+                       choice == filter_added ? "added" : "removed",
+                       taken.Format("%Y-%m-%d %H:%M")));
+    results_counter_label->SetToolTip(wxString());
+  }
+
+  void OnFilter(wxCommandEvent&)
+  {
+    const auto choice = result_filter->GetSelection();
+    if (choice == filter_all) {
+      ShowPaths(*results_);
+      ShowSummary(last_stats_);
+    } else if (diff_ready_) {
+      ShowDiff(choice);
+    } else if (!snapshot_busy_) {
+      // Sorting the matches and merging them with the snapshot takes a
+      // while for millions of them. See snapshot::Compare().
+      results_counter_label->SetLabel("comparing with the snapshot...");
+      RunSnapshotTask(message_code::snapshot_compared,
+                      [path = SnapshotPath(),
+                       description = snapshot_description_,
+                       results = results_](SnapshotOutcome& outcome) {
+                        outcome.comparison = snapshot::Compare(
+                          path, description, *results);
+                      });
+    }
+  }
+
+  void OnSaveSnapshot(wxCommandEvent&)
+  {
+    if (Searching() || snapshot_description_.empty()) {
+      wxLogError("Only the results of a complete search can be saved "
+                 "as a snapshot.");
+      return;
+    }
+    if (snapshot_busy_) {
+      return; // the label says what it is busy with
+    }
+    results_counter_label->SetLabel("saving the snapshot...");
+    RunSnapshotTask(
+      message_code::snapshot_saved,
+      [directory = PathFromUtf8(
+         GetFullPath(settings->snapshot_directory)),
+       path = SnapshotPath(),
+       description = snapshot_description_,
+       results = results_](SnapshotOutcome&) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        if (!snapshot::Write(path,
+                             description,
+                             History::Now(),
+                             snapshot::SortedEntries(*results))) {
+          throw std::runtime_error("can't write '" +
+                                   WideToUtf8(path.wstring()) + "'");
+        }
+      });
+  }
+
   void OnClose(wxCommandEvent&)
   {
-    // important: before terminating, we _must_ wait for our joinable
-    // thread to end, if it's running; in fact it uses variables of this
+    // important: before terminating, we _must_ wait for the search
+    // task to end, if it's running; in fact it uses variables of this
     // instance and posts events to *this event handler
-    if (GetThread() && // DoStartALongTask() may have not been called
-        GetThread()->IsRunning())
-      // GetThread()->Wait(); // wait for the thread to join
-      // delete the thread gracefully, TestDestroy() will return true
-      GetThread()->Delete();
+    WaitForSearch();
     Destroy();
   }
 
@@ -631,6 +1041,9 @@ class cApp : public wxApp
 {
 public:
   Frame* frame = nullptr;
+  // Kept for the whole process so that its threads are started once.
+  // Outlives the frame, which waits for its search when destroyed.
+  std::unique_ptr<SearchEngine> engine;
   cApp(){};
   ~cApp(){};
 
@@ -654,14 +1067,15 @@ public:
     const wxString default_search_folder =
       arg_count > 2 ? wxTheApp->argv[2] : wxString("");
 
-    frame = new Frame(default_ptrn, default_search_folder);
+    engine = std::make_unique<SearchEngine>();
+    frame = new Frame(*engine, default_ptrn, default_search_folder);
     frame->Show();
     return true;
   }
   virtual int OnExit()
   {
 #ifdef _DEBUG
-    void FlushLogging();
+    FlushLogging();
 #endif
     return 0;
   }
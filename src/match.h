@@ -0,0 +1,92 @@
+#ifndef FINDIR_MATCH_H
+#define FINDIR_MATCH_H
+
+#include <regex>
+#include <string>
+#include <string_view>
+
+#include "text.h"
+
+/**
+ * Case fold a regular expression pattern into the UTF-16 form the
+ * expression is compiled from (see Matcher).
+ * Escape sequences of ASCII characters are copied untouched since
+ * folding would change their meaning ("\D" is not "\d"). An escaped
+ * non-ASCII character has no special meaning; it is folded as a plain
+ * character without the backslash. Everything else is folded
+ * the same way as enumerated names, which lets the expression be
+ * compiled without std::regex_constants::icase.
+ */
+inline std::wstring
+FoldPattern(std::string_view pattern)
+{
+  const auto wide = Utf8ToWide(pattern);
+  const std::wstring_view in(wide);
+  std::wstring out;
+  auto fold = [&out](std::wstring_view s) {
+    out += Utf8ToWide(FoldCase(s));
+  };
+  std::wstring_view::size_type start = 0;
+  for (std::wstring_view::size_type i = 0; i < in.size(); ++i) {
+    if (in[i] != L'\\' || i + 1 == in.size()) {
+      continue;
+    }
+    fold(in.substr(start, i - start));
+    if (in[i + 1] < 0x80) {
+      out += in.substr(i, 2);
+      start = i + 2;
+    } else {
+      start = i + 1; // folded with what follows
+    }
+    ++i;
+  }
+  fold(in.substr(start));
+  return out;
+}
+
+/**
+ * Matches a search pattern against the folded form of a path.
+ * Searches are always case insensitive. Folding happens once for the
+ * pattern and once per enumerated path (see FoldedString) so no case
+ * translation is performed per compared character.
+ *
+ * Text patterns are compared with the folded UTF-8 bytes directly. A
+ * regex runs over the folded path converted to UTF-16, so that a
+ * character class or repetition applies to whole characters rather
+ * than to single bytes of them (outside the Basic Multilingual Plane
+ * they are still pairs of code units).
+ *
+ * Will throw std::regex_error if a regex pattern fails to compile.
+ */
+class Matcher
+{
+private:
+  bool use_text_ = false;
+  std::string needle_;
+  std::wregex regex_;
+
+public:
+  Matcher(const std::string& pattern, bool use_text)
+    : use_text_(use_text)
+  {
+    if (use_text_) {
+      needle_ = FoldCase(pattern);
+    } else {
+      regex_ = std::wregex(FoldPattern(pattern),
+                           std::regex_constants::ECMAScript |
+                             std::regex_constants::optimize);
+    }
+  }
+
+  // 'folded' must come from FoldedString::folded or an index file
+  bool Matches(std::string_view folded) const
+  {
+    if (use_text_) {
+      return folded.find(needle_) != std::string_view::npos;
+    }
+    const auto wide = Utf8ToWide(folded);
+    return std::regex_search(wide, regex_);
+  }
+};
+
+#endif /* FINDIR_MATCH_H */
@@ -0,0 +1,165 @@
+#ifndef FINDIR_POOL_H
+#define FINDIR_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker threads that live as long as the application, so that a search
+ * doesn't pay for starting threads. Tasks run in the order they were
+ * submitted.
+ *
+ * Tasks may block (directory reads do) and may submit more tasks, but a
+ * task that waits for other tasks needs a free worker for each of them.
+ * Reserve() enough workers before submitting such a task.
+ */
+class ThreadPool
+{
+private:
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> threads_;
+  bool stop_ = false;
+
+  void Run()
+  {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock,
+                    [this]() { return stop_ || !tasks_.empty(); });
+        if (stop_) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  explicit ThreadPool(int threads) { Reserve(threads); }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Tasks that haven't started yet are dropped.
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    ready_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Start more workers if there are fewer than 'threads'. Workers are
+  // never stopped before the pool is destroyed.
+  void Reserve(int threads)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (static_cast<int>(threads_.size()) < threads) {
+      threads_.emplace_back([this]() { Run(); });
+    }
+  }
+
+  int size()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(threads_.size());
+  }
+
+  std::future<void> Submit(std::function<void()> task)
+  {
+    auto packaged =
+      std::make_shared<std::packaged_task<void()>>(std::move(task));
+    auto future = packaged->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back([packaged]() { (*packaged)(); });
+    }
+    ready_.notify_one();
+    return future;
+  }
+};
+
+/**
+ * Calls 'work(i)' for every i in [0, n) spread over the calling thread
+ * and up to 'helpers' pool workers, and returns once all calls
+ * returned.
+ *
+ * Every participating thread first calls 'make_work()' and then uses
+ * the function it returned for all the items it takes, which is where
+ * per-thread state such as a copy of a Matcher lives. Items are handed
+ * out in increasing order, one at a time.
+ *
+ * The caller takes part, so this never waits on a busy pool. Helpers
+ * that only start after all items were taken return without calling
+ * anything.
+ */
+template<typename MakeWork>
+void
+ParallelFor(ThreadPool& pool, size_t n, int helpers, MakeWork make_work)
+{
+  struct State
+  {
+    std::atomic<size_t> next = 0;
+    size_t n = 0;
+    std::mutex mutex;
+    std::condition_variable all_done;
+    size_t done = 0;
+  };
+  auto state = std::make_shared<State>();
+  state->n = n;
+
+  // Only ever called while items are left, and the caller doesn't
+  // return before every item is done, so capturing by reference is
+  // safe.
+  auto participate = [&make_work, raw = state.get()]() {
+    size_t i = raw->next.fetch_add(1);
+    if (i >= raw->n) {
+      return;
+    }
+    auto work = make_work();
+    size_t finished = 0;
+    for (; i < raw->n; i = raw->next.fetch_add(1)) {
+      work(i);
+      finished++;
+    }
+    std::lock_guard<std::mutex> lock(raw->mutex);
+    raw->done += finished;
+    if (raw->done == raw->n) {
+      raw->all_done.notify_all();
+    }
+  };
+
+  helpers = static_cast<int>(
+    std::min<size_t>(std::max(helpers, 0), n > 0 ? n - 1 : 0));
+  for (int h = 0; h < helpers; ++h) {
+    // 'state' outlives this call for helpers that start late
+    pool.Submit([state, participate]() { participate(); });
+  }
+  participate();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->all_done.wait(lock, [&state]() {
+    return state->done == state->n;
+  });
+}
+
+#endif /* FINDIR_POOL_H */
@@ -0,0 +1,86 @@
+#ifndef FINDIR_RING_H
+#define FINDIR_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * Fixed capacity, lock-free, single-producer/single-consumer queue.
+ *
+ * Exactly one thread may call TryPush() and exactly one other thread
+ * may call TryPop()/Drain(). Nothing is allocated after construction;
+ * when the ring is full TryPush() fails and it is up to the producer to
+ * wait, which is how backpressure reaches the search thread.
+ *
+ * 'Capacity' must be a power of two.
+ */
+template<typename T, size_t Capacity>
+class SpscRing
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+private:
+  // Head and tail are only ever written by one side each. Keep them on
+  // separate cache lines so the two threads don't fight over one.
+  alignas(64) std::atomic<size_t> head_ = 0; // next slot to pop
+  alignas(64) std::atomic<size_t> tail_ = 0; // next slot to push
+  alignas(64) std::array<T, Capacity> slots_;
+
+public:
+  SpscRing() = default;
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Producer only. 'value' is moved from on success only.
+  bool TryPush(T& value)
+  {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == Capacity) {
+      return false; // full
+    }
+    slots_[tail & (Capacity - 1)] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only.
+  bool TryPop(T& out)
+  {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false; // empty
+    }
+    out = std::move(slots_[head & (Capacity - 1)]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Hands at most 'limit' items to 'f' and returns how
+  // many were consumed. Slots are released in one store at the end.
+  template<typename F>
+  size_t Drain(F f, size_t limit = Capacity)
+  {
+    const auto head = head_.load(std::memory_order_relaxed);
+    const auto tail = tail_.load(std::memory_order_acquire);
+    size_t n = tail - head;
+    if (n > limit) {
+      n = limit;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      f(std::move(slots_[(head + i) & (Capacity - 1)]));
+    }
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  bool empty() const
+  {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+};
+
+#endif /* FINDIR_RING_H */
@@ -1,10 +1,344 @@
-#include <Windows.h>
-#include <wx/thread.h>
-#include <wx/wx.h>
+#ifndef FINDIR_SEARCH_H
+#define FINDIR_SEARCH_H
 
 #include <algorithm>
+#include <cstdint>
 #include <filesystem>
-#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-#include "log.h"
+#include "filter.h"
+#include "index.h"
+#include "match.h"
+#include "pool.h"
+#include "text.h"
+#include "trace.h"
 #include "types.h"
+
+// Root paths are compared without a trailing separator so that "L:/"
+// and "L:" refer to the same index.
+inline std::string
+TrimSeparator(std::string s)
+{
+  while (!s.empty() && s.back() == '/') {
+    s.pop_back();
+  }
+  return s;
+}
+
+/**
+ * Returns true if 'index' was built for 'root' and is deep enough to
+ * answer a search of 'depth' (0 = unlimited).
+ */
+inline bool
+IndexCovers(const dirindex::IndexView& index,
+            const std::filesystem::path& root,
+            int depth)
+{
+  const auto max_depth = index.header().max_depth;
+  if (max_depth != 0 &&
+      (depth <= 0 || static_cast<uint32_t>(depth) > max_depth)) {
+    return false;
+  }
+  return TrimSeparator(FoldCase(index.root())) ==
+         TrimSeparator(FoldedString(root).folded);
+}
+
+/**
+ * Rebuild the display path of entry 'i' by following the parent links.
+ * Only called for matches, so the index walk itself never builds the
+ * display text.
+ */
+inline std::string
+IndexEntryText(const dirindex::IndexView& index,
+               uint32_t i,
+               const std::string& root_text)
+{
+  std::vector<std::string_view> names;
+  // depth bounds the loop in case of a corrupt parent chain
+  for (uint32_t n = index[i].depth; n > 0 && i < index.size(); --n) {
+    names.push_back(index.name(index[i]));
+    i = index[i].parent;
+    if (i == dirindex::kNoParent) {
+      break;
+    }
+  }
+  std::string text = root_text;
+  for (auto it = names.rbegin(); it != names.rend(); ++it) {
+    text += '/';
+    text += *it;
+  }
+  return text;
+}
+
+// Index entries matched by one task. Entries are stored contiguously,
+// so a chunk is one sequential pass over a slice of the mapping.
+const constexpr uint32_t kIndexChunk = 16384;
+// Chunks per worker matched before their matches are handed over;
+// bounds how many matches are held at once.
+const constexpr size_t kIndexChunksPerWave = 4;
+
+namespace search_detail {
+
+// The entry after the subtree of entry 'i'.
+inline uint32_t
+SkipSubtree(const dirindex::IndexView& index, uint32_t i)
+{
+  const auto end = index[i].subtree_end;
+  return (end > i && end <= index.size()) ? end : i + 1;
+}
+
+/**
+ * Matches the index entries in [begin, end) the same way a sequential
+ * pass over the whole index would, appending the display paths of the
+ * matches to 'matches'. Only called for ranges made of whole top level
+ * folders that the index answers for.
+ */
+inline void
+MatchIndexChunk(const dirindex::IndexView& index,
+                uint32_t begin,
+                uint32_t end,
+                int depth,
+                const std::string& root_text,
+                const std::string& root_folded,
+                const DirectoryFilter& filter,
+                const Matcher& matcher,
+                Strings& matches,
+                int& pruned)
+{
+  // The folded path of the current entry is maintained incrementally;
+  // 'lengths[d - 1]' is the size of 'folded' before the depth 'd'
+  // component was appended.
+  std::string folded;
+  std::vector<size_t> lengths;
+
+  // Rebuild 'folded' and 'lengths' for the ancestors of entry 'i' from
+  // the parent links. Returns 'i' when done, or where to continue
+  // instead if 'i' lies in an excluded subtree or its chain is broken.
+  std::vector<uint32_t> chain;
+  auto resume_at = [&](uint32_t i) -> uint32_t {
+    folded = root_folded;
+    lengths.clear();
+    chain.clear();
+    if (index[i].depth == 0) {
+      return i + 1;
+    }
+    uint32_t a = i;
+    for (uint32_t d = index[i].depth; d > 1; --d) {
+      a = index[a].parent;
+      if (a >= index.size() || index[a].depth != d - 1) {
+        return i + 1;
+      }
+      chain.push_back(a);
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      if (filter.Excludes(index.folded(index[*it]))) {
+        // counted by the chunk holding the excluded entry
+        return std::max(SkipSubtree(index, *it), i + 1);
+      }
+      lengths.push_back(folded.size());
+      folded += '/';
+      folded += index.folded(index[*it]);
+    }
+    return i;
+  };
+
+  uint32_t i = begin;
+  while (i < end) {
+    const auto resume = resume_at(i);
+    if (resume == i) {
+      break;
+    }
+    i = resume;
+  }
+
+  while (i < end) {
+    const auto& e = index[i];
+    if (e.depth == 0 || e.depth > lengths.size() + 1 ||
+        (depth > 0 && e.depth > static_cast<uint32_t>(depth))) {
+      i = SkipSubtree(index, i);
+      continue;
+    }
+    if (filter.Excludes(index.folded(e))) {
+      pruned++;
+      i = SkipSubtree(index, i);
+      continue;
+    }
+
+    if (lengths.size() >= e.depth) {
+      folded.resize(lengths[e.depth - 1]);
+      lengths.resize(e.depth - 1);
+    }
+    lengths.push_back(folded.size());
+    folded += '/';
+    folded += index.folded(e);
+
+    if (matcher.Matches(folded)) {
+      matches.push_back(IndexEntryText(index, i, root_text));
+    }
+    ++i;
+  }
+}
+
+} // namespace search_detail
+
+/**
+ * Search a prebuilt directory index of 'root' instead of walking it.
+ * Only directories are indexed, so only directories are matched.
+ *
+ * The root itself is listed live (a single directory read). Top level
+ * folders that were modified after the index was created, or that are
+ * missing from the index, are walked live. Folders that no longer exist
+ * are skipped.
+ *
+ * The index is matched in chunks spread over the calling thread and up
+ * to 'helpers' workers of 'pool', each with its own copy of 'matcher'.
+ * Matches are handed over in index order whatever thread found them,
+ * followed by the matches of the live walks.
+ *
+ * 'on_match' is called on the calling thread with the UTF-8 display
+ * path of every match. 'walk_live(folder, depth)' must match everything
+ * below 'folder' down to 'depth' levels (0 = unlimited); the folder
+ * itself is handled here. 'should_stop' is polled to cancel the search.
+ */
+template<typename OnMatch, typename WalkLive, typename ShouldStop>
+void
+SearchIndex(const dirindex::IndexView& index,
+            const std::filesystem::path& root,
+            int depth,
+            const DirectoryFilter& filter,
+            const Matcher& matcher,
+            ThreadPool& pool,
+            int helpers,
+            SearchStats& stats,
+            OnMatch on_match,
+            WalkLive walk_live,
+            ShouldStop should_stop)
+{
+  using namespace search_detail;
+
+  const FoldedString root_name(root);
+  const auto root_text = TrimSeparator(root_name.text);
+  const auto root_folded = TrimSeparator(root_name.folded);
+  const auto created = index.header().created;
+
+  // Top level folders as they are right now, by folded name.
+  std::unordered_map<std::string, std::filesystem::directory_entry>
+    live;
+  for (auto const& entry :
+       std::filesystem::directory_iterator{ root }) {
+    if (entry.is_directory()) {
+      const FoldedString name(entry.path());
+      live.emplace(std::string(name.folded_name()), entry);
+    }
+  }
+
+  // Decide for every top level folder whether the index answers for it,
+  // merging neighbouring folders into ranges of entries.
+  std::vector<std::filesystem::directory_entry> walk_later;
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  const uint32_t count = index.size();
+  for (uint32_t i = 0; i < count;) {
+    const auto next = SkipSubtree(index, i);
+    const auto& e = index[i];
+    auto it = e.depth == 1 ? live.find(std::string(index.folded(e)))
+                           : live.end();
+    if (it != live.end()) {
+      const auto entry = it->second;
+      live.erase(it);
+      const auto modified = entry.last_write_time().time_since_epoch();
+      if (modified.count() > created) {
+        walk_later.push_back(entry);
+      } else if (!ranges.empty() && ranges.back().second == i) {
+        ranges.back().second = next;
+      } else {
+        ranges.emplace_back(i, next);
+      }
+    }
+    i = next; // otherwise removed since the index was built
+  }
+  stats.answered_from_index = !ranges.empty();
+
+  struct Chunk
+  {
+    uint32_t begin;
+    uint32_t end;
+    Strings matches;
+    int pruned = 0;
+  };
+  std::vector<Chunk> chunks;
+  for (const auto& [begin, end] : ranges) {
+    for (uint32_t c = begin; c < end;) {
+      const uint32_t c_end =
+        end - c > kIndexChunk ? c + kIndexChunk : end;
+      chunks.push_back(Chunk{ c, c_end, {}, 0 });
+      c = c_end;
+    }
+  }
+
+  const size_t wave = (static_cast<size_t>(std::max(helpers, 0)) + 1) *
+                      kIndexChunksPerWave;
+  for (size_t first = 0; first < chunks.size(); first += wave) {
+    if (should_stop()) {
+      return;
+    }
+    const size_t n = std::min(wave, chunks.size() - first);
+    ParallelFor(pool, n, helpers, [&]() {
+      return [&, local = matcher](size_t k) {
+        auto& chunk = chunks[first + k];
+        trace::Span span("match chunk");
+        MatchIndexChunk(index,
+                        chunk.begin,
+                        chunk.end,
+                        depth,
+                        root_text,
+                        root_folded,
+                        filter,
+                        local,
+                        chunk.matches,
+                        chunk.pruned);
+      };
+    });
+    for (size_t k = first; k < first + n; ++k) {
+      stats.directories_pruned += chunks[k].pruned;
+      for (auto& text : chunks[k].matches) {
+        on_match(std::move(text));
+      }
+      Strings().swap(chunks[k].matches);
+    }
+  }
+
+  auto walk_folder = [&](const std::filesystem::directory_entry& e) {
+    FoldedString folder(e.path());
+    if (filter.Excludes(folder.folded_name())) {
+      stats.directories_pruned++;
+      return;
+    }
+    if (matcher.Matches(folder.folded)) {
+      on_match(folder.text);
+    }
+    // the folder itself is already one level deep
+    if (depth != 1) {
+      walk_live(e.path(), depth > 0 ? depth - 1 : 0);
+    }
+  };
+
+  // modified and new top level folders
+  for (auto const& entry : walk_later) {
+    if (should_stop()) {
+      return;
+    }
+    walk_folder(entry);
+  }
+  for (auto const& [name, entry] : live) {
+    if (should_stop()) {
+      return;
+    }
+    walk_folder(entry);
+  }
+}
+
+#endif /* FINDIR_SEARCH_H */
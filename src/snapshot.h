@@ -0,0 +1,385 @@
+#ifndef FINDIR_SNAPSHOT_H
+#define FINDIR_SNAPSHOT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "text.h"
+#include "types.h"
+
+/**
+ * Snapshots of a search's results, saved so that a later run of the
+ * same search can report which folders were added and removed since.
+ *
+ * A snapshot file holds the paths sorted by their folded text (see
+ * FoldedString), each stored as the number of leading bytes it shares
+ * with the path before it plus the rest (front coding). Sibling folders
+ * share everything up to their own name, so a snapshot is a fraction of
+ * the size of its paths as plain text. The display text is front coded
+ * the same way next to the folded text, which decides identity and
+ * order.
+ *
+ * Both sides of a comparison are read in order and compared in a single
+ * merge pass, so comparing holds one entry of each side at a time.
+ *
+ *   header:  "FDSN" u32 version, u64 created (seconds since the
+ *            epoch), u64 entry count, varint length + bytes of a
+ *            description
+ *   entries: varint shared, varint length + bytes of the folded rest,
+ *            varint shared, varint length + bytes of the text rest
+ *   trailer: u64 StableHash() of the bytes of all entries
+ */
+namespace snapshot {
+
+const constexpr char kMagic[4] = { 'F', 'D', 'S', 'N' };
+const constexpr uint32_t kVersion = 2;
+// longer paths or descriptions mean the file is damaged
+const constexpr uint64_t kMaxPartLength = 1 << 20;
+
+struct Entry
+{
+  std::string folded;
+  std::string text; // UTF-8
+};
+
+// Paths sorted by their folded text, duplicates removed.
+inline std::vector<Entry>
+SortedEntries(const Strings& paths)
+{
+  std::vector<Entry> entries;
+  entries.reserve(paths.size());
+  for (const auto& path : paths) {
+    entries.push_back(Entry{ FoldCase(std::string_view(path)), path });
+  }
+  std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+    return a.folded < b.folded;
+  });
+  entries.erase(std::unique(entries.begin(),
+                            entries.end(),
+                            [](auto& a, auto& b) {
+                              return a.folded == b.folded;
+                            }),
+                entries.end());
+  return entries;
+}
+
+inline void
+PutVarint(std::string& out, uint64_t v)
+{
+  while (v >= 0x80) {
+    out += static_cast<char>((v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  out += static_cast<char>(v);
+}
+
+inline size_t
+SharedPrefix(std::string_view a, std::string_view b)
+{
+  const auto n = std::min(a.size(), b.size());
+  size_t i = 0;
+  while (i < n && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+// FNV-1a, stable across builds. Names snapshot files and checks their
+// entries; 'h' continues the hash of what came before.
+inline uint64_t
+StableHash(std::string_view s, uint64_t h = 0xcbf29ce484222325ULL)
+{
+  for (const char c : s) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Writes 'entries', which must be sorted as by SortedEntries(), to
+// 'file_path' through a temporary file so that a failed write leaves
+// the previous snapshot in place. Returns false if writing failed.
+inline bool
+Write(const std::filesystem::path& file_path,
+      const std::string& description,
+      int64_t created,
+      const std::vector<Entry>& entries)
+{
+  auto temp = file_path;
+  temp += ".tmp";
+  {
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    std::string out(kMagic, sizeof(kMagic));
+    auto put_u64 = [&out](uint64_t v) {
+      out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    out.append(reinterpret_cast<const char*>(&kVersion),
+               sizeof(kVersion));
+    put_u64(static_cast<uint64_t>(created));
+    put_u64(entries.size());
+    PutVarint(out, description.size());
+    out += description;
+    file.write(out.data(), out.size());
+    out.clear();
+
+    uint64_t hash = StableHash({});
+    std::string_view last_folded;
+    std::string_view last_text;
+    for (const auto& e : entries) {
+      const auto folded_shared = SharedPrefix(last_folded, e.folded);
+      PutVarint(out, folded_shared);
+      PutVarint(out, e.folded.size() - folded_shared);
+      out.append(e.folded, folded_shared);
+      const auto text_shared = SharedPrefix(last_text, e.text);
+      PutVarint(out, text_shared);
+      PutVarint(out, e.text.size() - text_shared);
+      out.append(e.text, text_shared);
+      last_folded = e.folded;
+      last_text = e.text;
+      if (out.size() >= (1 << 16)) {
+        hash = StableHash(out, hash);
+        file.write(out.data(), out.size());
+        out.clear();
+      }
+    }
+    hash = StableHash(out, hash);
+    put_u64(hash);
+    file.write(out.data(), out.size());
+    if (!file) {
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(temp, file_path, ec);
+  return !ec;
+}
+
+/**
+ * Reads a snapshot file front to back. Throws std::runtime_error if the
+ * file can't be opened, isn't a snapshot or is damaged. Damage is
+ * found by the time Next() reports the end, so a comparison's outcome
+ * is only complete once it returned nullptr.
+ */
+class Reader
+{
+private:
+  std::ifstream file_;
+  std::string description_;
+  int64_t created_ = 0;
+  uint64_t remaining_ = 0; // entries not read yet
+  uint64_t hash_ = StableHash({}); // of the entry bytes read so far
+  bool first_ = true;
+  bool done_ = false;
+  Entry current_;
+
+  [[noreturn]] static void Damaged()
+  {
+    throw std::runtime_error("the snapshot file is damaged");
+  }
+
+  void Read(char* data, size_t size)
+  {
+    if (!file_.read(data, size)) {
+      Damaged();
+    }
+    hash_ = StableHash(std::string_view(data, size), hash_);
+  }
+
+  uint64_t ReadVarint()
+  {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      char c = 0;
+      Read(&c, 1);
+      v |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) {
+        return v;
+      }
+    }
+    Damaged();
+  }
+
+  // Replaces the part of 's' after the prefix it shares with the
+  // previous entry and returns the length of that prefix. 'replaced' is
+  // set to the byte the prefix was followed by, -1 if none.
+  size_t ReadPart(std::string& s, int& replaced)
+  {
+    const auto shared = ReadVarint();
+    const auto length = ReadVarint();
+    if (shared > s.size() || length > kMaxPartLength) {
+      Damaged();
+    }
+    replaced = shared < s.size()
+                 ? static_cast<unsigned char>(s[shared])
+                 : -1;
+    s.resize(shared + length);
+    Read(s.data() + shared, length);
+    return shared;
+  }
+
+public:
+  explicit Reader(const std::filesystem::path& file_path)
+    : file_(file_path, std::ios::binary)
+  {
+    if (!file_) {
+      throw std::runtime_error("the snapshot file can't be opened");
+    }
+    char magic[sizeof(kMagic)] = {};
+    uint32_t version = 0;
+    uint64_t created = 0;
+    file_.read(magic, sizeof(magic));
+    file_.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!file_ || !std::equal(magic, magic + sizeof(magic), kMagic) ||
+        version != kVersion) {
+      throw std::runtime_error("not a snapshot file");
+    }
+    Read(reinterpret_cast<char*>(&created), sizeof(created));
+    Read(reinterpret_cast<char*>(&remaining_), sizeof(remaining_));
+    const auto length = ReadVarint();
+    if (length > kMaxPartLength) {
+      Damaged();
+    }
+    description_.resize(length);
+    Read(description_.data(), length);
+    created_ = static_cast<int64_t>(created);
+    // only the entries are covered by the trailer
+    hash_ = StableHash({});
+  }
+
+  const std::string& description() const { return description_; }
+  int64_t created() const { return created_; }
+
+  // The next entry, valid until the next call, or nullptr at the end.
+  const Entry* Next()
+  {
+    if (remaining_ == 0) {
+      if (!done_) {
+        done_ = true;
+        const auto hash = hash_;
+        uint64_t trailer = 0;
+        Read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+        if (trailer != hash ||
+            file_.peek() != std::ifstream::traits_type::eof()) {
+          Damaged();
+        }
+      }
+      return nullptr;
+    }
+    remaining_--;
+    // The merge relies on the order, so it is checked as it goes: the
+    // first byte that differs from the previous entry must be greater.
+    int replaced = -1;
+    const auto shared = ReadPart(current_.folded, replaced);
+    if (!first_ &&
+        (shared >= current_.folded.size() ||
+         static_cast<unsigned char>(current_.folded[shared]) <=
+           replaced)) {
+      Damaged();
+    }
+    ReadPart(current_.text, replaced);
+    first_ = false;
+    return &current_;
+  }
+};
+
+// Presents sorted entries in memory like a Reader.
+class EntrySource
+{
+private:
+  const std::vector<Entry>& entries_;
+  size_t next_ = 0;
+
+public:
+  explicit EntrySource(const std::vector<Entry>& entries)
+    : entries_(entries)
+  {
+  }
+
+  const Entry* Next()
+  {
+    return next_ < entries_.size() ? &entries_[next_++] : nullptr;
+  }
+};
+
+/**
+ * Single merge pass over two sorted sources (Reader or EntrySource).
+ * Calls 'on_added(const Entry&)' for entries only in 'after' and
+ * 'on_removed(const Entry&)' for entries only in 'before', both in
+ * sorted order.
+ */
+template<typename Before, typename After, typename OnAdded,
+         typename OnRemoved>
+void
+Diff(Before& before,
+     After& after,
+     OnAdded on_added,
+     OnRemoved on_removed)
+{
+  const Entry* a = before.Next();
+  const Entry* b = after.Next();
+  while (a || b) {
+    if (!b || (a && a->folded < b->folded)) {
+      on_removed(*a);
+      a = before.Next();
+    } else if (!a || b->folded < a->folded) {
+      on_added(*b);
+      b = after.Next();
+    } else {
+      a = before.Next();
+      b = after.Next();
+    }
+  }
+}
+
+struct Comparison
+{
+  Strings added;   // UTF-8 display text, in sorted order
+  Strings removed; // likewise
+  int64_t created = 0; // of the snapshot compared with
+};
+
+// Compares 'paths' with the snapshot of the search 'description' in
+// 'file_path'. Throws std::runtime_error if the file can't be read or
+// was saved for another search.
+inline Comparison
+Compare(const std::filesystem::path& file_path,
+        const std::string& description,
+        const Strings& paths)
+{
+  Reader before(file_path);
+  if (before.description() != description) {
+    throw std::runtime_error("it was saved for another search");
+  }
+  const auto entries = SortedEntries(paths);
+  EntrySource after(entries);
+  Comparison comparison;
+  comparison.created = before.created();
+  Diff(
+    before,
+    after,
+    [&](const Entry& e) { comparison.added.push_back(e.text); },
+    [&](const Entry& e) { comparison.removed.push_back(e.text); });
+  return comparison;
+}
+
+// One snapshot per distinct search, named after its description.
+inline std::string
+FileName(const std::string& description)
+{
+  const auto hash =
+    static_cast<unsigned long long>(StableHash(description));
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.fds", hash);
+  return name;
+}
+
+} // namespace snapshot
+
+#endif /* FINDIR_SNAPSHOT_H */
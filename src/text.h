@@ -0,0 +1,138 @@
+#ifndef FINDIR_TEXT_H
+#define FINDIR_TEXT_H
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <windows.h>
+
+// NormalizeString() lives in Normaliz.dll
+#pragma comment(lib, "Normaliz")
+
+/**
+ * Paths are kept as UTF-8 inside the program. Windows hands them out as
+ * UTF-16, so convert exactly once at enumeration time rather than
+ * taking a lossy trip through the ANSI code page.
+ */
+inline std::string
+WideToUtf8(std::wstring_view s)
+{
+  if (s.empty()) {
+    return {};
+  }
+  const int in_len = static_cast<int>(s.size());
+  const int n =
+    WideCharToMultiByte(CP_UTF8, 0, s.data(), in_len, nullptr, 0, 0, 0);
+  std::string out(n, '\0');
+  WideCharToMultiByte(
+    CP_UTF8, 0, s.data(), in_len, out.data(), n, 0, 0);
+  return out;
+}
+
+inline std::wstring
+Utf8ToWide(std::string_view s)
+{
+  if (s.empty()) {
+    return {};
+  }
+  const int in_len = static_cast<int>(s.size());
+  const int n =
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), in_len, nullptr, 0);
+  std::wstring out(n, L'\0');
+  MultiByteToWideChar(CP_UTF8, 0, s.data(), in_len, out.data(), n);
+  return out;
+}
+
+inline std::filesystem::path
+PathFromUtf8(std::string_view s)
+{
+  return std::filesystem::path(Utf8ToWide(s));
+}
+
+/**
+ * Returns the NFC normalized, lower cased UTF-8 form of 's'.
+ * Case mapping uses the invariant locale so that the result does not
+ * depend on the user's regional settings. On failure the input is
+ * returned unmodified.
+ */
+inline std::string
+FoldCase(std::wstring_view s)
+{
+  if (s.empty()) {
+    return {};
+  }
+  // Normalize first so that a precomposed and a decomposed 'e' with an
+  // accent fold to the same bytes.
+  std::wstring normal;
+  const int in_len = static_cast<int>(s.size());
+  int n = NormalizeString(NormalizationC, s.data(), in_len, nullptr, 0);
+  if (n > 0) {
+    normal.resize(n);
+    n = NormalizeString(
+      NormalizationC, s.data(), in_len, normal.data(), n);
+  }
+  if (n > 0) {
+    normal.resize(n);
+  } else {
+    normal.assign(s);
+  }
+
+  std::wstring lower(normal.size(), L'\0');
+  const int len = static_cast<int>(normal.size());
+  n = LCMapStringEx(LOCALE_NAME_INVARIANT,
+                    LCMAP_LOWERCASE,
+                    normal.data(),
+                    len,
+                    lower.data(),
+                    len,
+                    nullptr,
+                    nullptr,
+                    0);
+  if (n <= 0) {
+    return WideToUtf8(normal);
+  }
+  lower.resize(n);
+  return WideToUtf8(lower);
+}
+
+inline std::string
+FoldCase(std::string_view utf8)
+{
+  return FoldCase(std::wstring_view(Utf8ToWide(utf8)));
+}
+
+/**
+ * An enumerated path stored as UTF-8 for display together with a
+ * shadow copy that has been case folded and normalized. Matchers run
+ * plain byte comparisons against 'folded'; anything shown to the user
+ * or handed to the shell uses 'text'.
+ */
+struct FoldedString
+{
+  std::string text;
+  std::string folded;
+
+  FoldedString() = default;
+
+  explicit FoldedString(const std::filesystem::path& path)
+  {
+    const auto wide = path.generic_wstring();
+    text = WideToUtf8(wide);
+    folded = FoldCase(std::wstring_view(wide));
+  }
+
+  // The folded last path component (folder or file name).
+  std::string_view folded_name() const
+  {
+    const auto pos = folded.find_last_of('/');
+    return pos == std::string::npos
+             ? std::string_view(folded)
+             : std::string_view(folded).substr(pos + 1);
+  }
+};
+
+using FoldedStrings = std::vector<FoldedString>;
+
+#endif /* FINDIR_TEXT_H */
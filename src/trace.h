@@ -0,0 +1,241 @@
+#ifndef FINDIR_TRACE_H
+#define FINDIR_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Opt-in timeline of a single search, written in the Chrome trace event
+ * format so it can be loaded in chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records spans into its own buffer. The buffer's mutex is
+ * only ever contended while the trace is being written out, so
+ * recording a span costs two clock reads and a vector append. When
+ * tracing is off a span costs one relaxed atomic load.
+ *
+ *   trace::Start();
+ *   {
+ *     trace::Span span("read directory", path);
+ *     ...
+ *   }
+ *   trace::Stop("trace.json");
+ */
+namespace trace {
+
+struct Event
+{
+  const char* name; // must be a string literal
+  std::string arg;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+struct ThreadBuffer
+{
+  std::mutex mutex;
+  uint32_t id = 0;
+  std::string name;
+  std::vector<Event> events;
+};
+
+struct Registry
+{
+  std::atomic<bool> enabled = false;
+  std::chrono::steady_clock::time_point origin;
+  std::mutex mutex;
+  // Buffers are owned here rather than by the thread so that events of
+  // threads that already exited can still be written out.
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+inline Registry&
+GetRegistry()
+{
+  static Registry registry;
+  return registry;
+}
+
+inline bool
+Enabled()
+{
+  return GetRegistry().enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t
+Now()
+{
+  const auto elapsed =
+    std::chrono::steady_clock::now() - GetRegistry().origin;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+    .count();
+}
+
+inline ThreadBuffer&
+LocalBuffer()
+{
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (!buffer) {
+    auto& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = registry.buffers.back().get();
+    buffer->id = static_cast<uint32_t>(registry.buffers.size());
+    buffer->name = "thread " + std::to_string(buffer->id);
+  }
+  return *buffer;
+}
+
+// Label the calling thread in the trace viewer.
+inline void
+NameThread(std::string name)
+{
+  auto& buffer = LocalBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.name = std::move(name);
+}
+
+// Records the time between construction and destruction, if tracing
+// was on when it was constructed.
+class Span
+{
+private:
+  const char* name_;
+  std::string arg_;
+  int64_t start_us_ = -1;
+
+public:
+  explicit Span(const char* name, std::string_view arg = {})
+    : name_(name)
+  {
+    if (Enabled()) {
+      arg_.assign(arg);
+      start_us_ = Now();
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  // Replace the argument, e.g. with a count known only at the end.
+  void SetArg(std::string arg)
+  {
+    if (start_us_ >= 0) {
+      arg_ = std::move(arg);
+    }
+  }
+
+  ~Span() { End(); }
+
+  // Record the span now rather than on destruction.
+  void End()
+  {
+    if (start_us_ < 0 || !Enabled()) {
+      return;
+    }
+    const auto end_us = Now();
+    auto& buffer = LocalBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(
+      Event{ name_, std::move(arg_), start_us_, end_us - start_us_ });
+    start_us_ = -1;
+  }
+};
+
+// Discards anything recorded before and starts recording.
+inline void
+Start()
+{
+  auto& registry = GetRegistry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (auto& buffer : registry.buffers) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      buffer->events.clear();
+    }
+    registry.origin = std::chrono::steady_clock::now();
+  }
+  registry.enabled.store(true, std::memory_order_release);
+}
+
+inline std::string
+EscapeJson(std::string_view s)
+{
+  std::string out;
+  out.reserve(s.size());
+  for (const char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += c;
+        }
+        break;
+    }
+  }
+  return out;
+}
+
+/**
+ * Stops recording and writes everything recorded since Start() to
+ * 'file_path' as Chrome trace JSON. Returns false if the file couldn't
+ * be written.
+ */
+inline bool
+Stop(const std::string& file_path)
+{
+  auto& registry = GetRegistry();
+  if (!registry.enabled.exchange(false)) {
+    return false;
+  }
+  std::ofstream file(file_path,
+                     std::ios_base::out | std::ios_base::trunc);
+  file << "{\"traceEvents\":[\n";
+  bool first = true;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (auto& buffer : registry.buffers) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    if (buffer->events.empty()) {
+      continue;
+    }
+    file << (first ? "" : ",\n")
+         << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+         << buffer->id << ",\"args\":{\"name\":\""
+         << EscapeJson(buffer->name) << "\"}}";
+    first = false;
+    for (const auto& event : buffer->events) {
+      file << ",\n{\"ph\":\"X\",\"name\":\"" << event.name
+           << "\",\"pid\":1,\"tid\":" << buffer->id
+           << ",\"ts\":" << event.start_us
+           << ",\"dur\":" << event.duration_us;
+      if (!event.arg.empty()) {
+        file << ",\"args\":{\"detail\":\"" << EscapeJson(event.arg)
+             << "\"}";
+      }
+      file << "}";
+    }
+    buffer->events.clear();
+  }
+  file << "\n]}\n";
+  return static_cast<bool>(file);
+}
+
+} // namespace trace
+
+#endif /* FINDIR_TRACE_H */
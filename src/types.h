@@ -1,15 +1,65 @@
 #ifndef FINDIR_TYPES_H
 #define FINDIR_TYPES_H
 
+#include <map>
+#include <string>
+#include <vector>
+
 using Strings = std::vector<std::string>;
 
 namespace message_code {
 enum message_code_ {
   log_error,
-  search_result,
-  search_lump_results,
-  search_finished
+  search_finished,
+  snapshot_saved,
+  snapshot_compared
 };
 }  // namespace message_code
 
+// A directory that couldn't be read and was left out of the search.
+struct SkippedDirectory
+{
+  std::string path; // UTF-8
+  std::string reason;
+};
+
+// Only the first few skipped directories are kept for the summary; the
+// rest are still counted.
+const constexpr size_t max_skipped_listed = 100;
+
+// Counters collected by the search thread and reported in the summary
+// once the search is finished.
+struct SearchStats
+{
+  int directories_pruned = 0;
+  int directories_read = 0;
+  int read_retries = 0;
+  int peak_concurrent_reads = 0;
+  // most directories waiting to be read at any one time
+  int peak_pending_directories = 0;
+  // the search stopped early at 'max_results'
+  bool result_limit_reached = false;
+  bool cancelled = false;
+  // some folders were answered from an index, which may be out of date
+  // below their top level
+  bool answered_from_index = false;
+  // why the search failed, empty if it didn't
+  std::string error;
+  // directories reached again through another path, not read twice
+  int duplicates_skipped = 0;
+  // directories that couldn't be read, counted by reason
+  int directories_skipped = 0;
+  std::map<std::string, int> skip_reasons;
+  std::vector<SkippedDirectory> skipped;
+
+  void AddSkipped(std::string path, std::string reason)
+  {
+    directories_skipped++;
+    skip_reasons[reason]++;
+    if (skipped.size() < max_skipped_listed) {
+      skipped.push_back({ std::move(path), std::move(reason) });
+    }
+  }
+};
+
 #endif /* FINDIR_TYPES_H */
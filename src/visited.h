@@ -0,0 +1,116 @@
+#ifndef FINDIR_VISITED_H
+#define FINDIR_VISITED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+/**
+ * Fixed size, lock-free set of 64 bit keys used to remember which
+ * directories a walk has already read (see DirectoryIdentity()).
+ *
+ * Open addressing with linear probing over an array of atomics, so any
+ * number of reader threads may insert at once. Memory is allocated once
+ * up front: 8 bytes per slot and 4 slots per 3 keys, so that the table
+ * is never more than three quarters full. Once it holds 'max_keys' the
+ * set stops accepting keys rather than growing; Insert() then reports
+ * 'full' and the caller carries on without protection for that
+ * directory. If the table can't be allocated the set is disabled the
+ * same way.
+ */
+class VisitedSet
+{
+private:
+  std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+  size_t slot_count_ = 0;
+  size_t max_size_ = 0;
+  std::atomic<size_t> size_ = 0;
+
+  // 0 marks an empty slot, so keys are remapped away from it
+  static uint64_t Key(uint64_t key) { return key ? key : 1; }
+
+public:
+  enum class Result
+  {
+    added,
+    present,
+    full
+  };
+
+  // 0 disables the set without allocating anything; every insert
+  // reports 'full'. So does a failed allocation.
+  explicit VisitedSet(size_t max_keys)
+  {
+    if (max_keys == 0) {
+      return;
+    }
+    // keys are well mixed (see HashIdentity()), so the table doesn't
+    // need a power of two size
+    const auto slot_count = max_keys + max_keys / 3 + 1;
+    try {
+      slots_ = std::make_unique<std::atomic<uint64_t>[]>(slot_count);
+    } catch (const std::bad_alloc&) {
+      return;
+    }
+    slot_count_ = slot_count;
+    max_size_ = max_keys;
+  }
+
+  VisitedSet(const VisitedSet&) = delete;
+  VisitedSet& operator=(const VisitedSet&) = delete;
+
+  Result Insert(uint64_t key)
+  {
+    if (!slots_) {
+      return Result::full;
+    }
+    key = Key(key);
+    for (size_t i = key % slot_count_;;
+         i = i + 1 < slot_count_ ? i + 1 : 0) {
+      uint64_t current = slots_[i].load(std::memory_order_acquire);
+      if (current == key) {
+        return Result::present;
+      }
+      if (current == 0) {
+        // reserve room before claiming the slot so the table can never
+        // fill up completely and make probing endless
+        const auto size =
+          size_.fetch_add(1, std::memory_order_relaxed);
+        if (size >= max_size_) {
+          size_.fetch_sub(1, std::memory_order_relaxed);
+          return Result::full;
+        }
+        if (slots_[i].compare_exchange_strong(
+              current, key, std::memory_order_acq_rel)) {
+          return Result::added;
+        }
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        if (current == key) {
+          return Result::present; // another thread got there first
+        }
+      }
+    }
+  }
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+};
+
+// Mixes the parts of a file identity into a well distributed key.
+inline uint64_t
+HashIdentity(uint64_t volume, uint64_t high, uint64_t low)
+{
+  auto mix = [](uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  };
+  return mix(volume ^ mix(high ^ mix(low)));
+}
+
+#endif /* FINDIR_VISITED_H */
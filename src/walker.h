@@ -0,0 +1,629 @@
+#ifndef FINDIR_WALKER_H
+#define FINDIR_WALKER_H
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <windows.h>
+
+#include "filter.h"
+#include "log.h"
+#include "match.h"
+#include "pool.h"
+#include "text.h"
+#include "trace.h"
+#include "types.h"
+#include "visited.h"
+
+// Bounds on the number of directory reads in flight at once. Read from
+// the settings file; see config::Settings.
+struct WalkLimits
+{
+  int min_reads = 1;
+  int max_reads = 16;
+
+  // reader threads a Walk() takes from the pool
+  int readers() const { return std::max({ 1, min_reads, max_reads }); }
+};
+
+/**
+ * AIMD (additive increase, multiplicative decrease) control of the
+ * number of directory reads in flight.
+ *
+ * Starts at the minimum and grows by one per completed read until the
+ * first sign of congestion (slow start), then by one per window. A read
+ * that failed with a transient network error, or smoothed latency well
+ * above the best latency seen, halves the limit. Local disks answer
+ * fast enough that the limit quickly reaches the maximum; a congested
+ * share settles at whatever it can serve without queuing.
+ */
+class ReadController
+{
+private:
+  double min_;
+  double max_;
+  double limit_;
+  bool slow_start_ = true;
+  double baseline_ms_ = -1.0;
+  double smoothed_ms_ = -1.0;
+  double since_decrease_ = 0.0;
+
+  void Decrease()
+  {
+    slow_start_ = false;
+    // At most once per window of reads so that one burst of slow
+    // replies (all issued at the old limit) doesn't collapse the limit.
+    if (since_decrease_ < limit_) {
+      return;
+    }
+    since_decrease_ = 0.0;
+    limit_ = std::max(min_, limit_ / 2.0);
+  }
+
+public:
+  explicit ReadController(const WalkLimits& limits)
+    : min_(std::max(1, limits.min_reads))
+    , max_(std::max(min_, double(limits.max_reads)))
+    , limit_(min_)
+  {
+  }
+
+  int limit() const { return static_cast<int>(limit_); }
+
+  void OnSuccess(std::chrono::duration<double, std::milli> latency)
+  {
+    const double ms = latency.count();
+    // The baseline creeps upward so that it can re-learn if the server
+    // gets permanently slower.
+    baseline_ms_ =
+      baseline_ms_ < 0.0 ? ms : std::min(ms, baseline_ms_ * 1.01);
+    smoothed_ms_ =
+      smoothed_ms_ < 0.0 ? ms : 0.8 * smoothed_ms_ + 0.2 * ms;
+    since_decrease_ += 1.0;
+
+    if (smoothed_ms_ > 2.0 * baseline_ms_ + 2.0) {
+      Decrease();
+      return;
+    }
+    limit_ += slow_start_ ? 1.0 : 1.0 / limit_;
+    limit_ = std::min(max_, limit_);
+  }
+
+  void OnError()
+  {
+    since_decrease_ += 1.0;
+    Decrease();
+  }
+};
+
+// Errors a busy or flaky share returns that are worth retrying.
+inline bool
+IsTransientReadError(const std::error_code& ec)
+{
+  if (ec.category() != std::system_category()) {
+    return false;
+  }
+  switch (ec.value()) {
+    case ERROR_NETWORK_BUSY:
+    case ERROR_UNEXP_NET_ERR:
+    case ERROR_NETNAME_DELETED:
+    case ERROR_TOO_MANY_CMDS:
+    case ERROR_REQ_NOT_ACCEP:
+    case ERROR_SEM_TIMEOUT:
+    case ERROR_SHARING_PAUSED:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Short description of why a directory couldn't be read, such as
+// "Access is denied", for the results summary.
+inline std::string
+ReadErrorReason(const std::error_code& ec)
+{
+  auto reason = ec.message();
+  while (!reason.empty() &&
+         (std::isspace(static_cast<unsigned char>(reason.back())) ||
+          reason.back() == '.')) {
+    reason.pop_back();
+  }
+  return reason;
+}
+
+namespace walk_detail {
+
+const constexpr int kMaxReadAttempts = 3;
+// A retried read waits this long, doubled for every further attempt,
+// so that the attempts don't all fall into one busy spell of the share.
+const constexpr auto kRetryDelay = std::chrono::milliseconds(250);
+
+struct Job
+{
+  std::filesystem::path path;
+  int depth = 0; // depth of 'path' below the root, root = 0
+  int attempts = 0;
+  uint64_t id = 0; // unique within one walk, see Walk()
+  // a retried read isn't issued before then
+  std::chrono::steady_clock::time_point not_before{};
+};
+
+struct Child
+{
+  std::filesystem::path path;
+  FoldedString name;
+  bool is_directory = false;
+  bool descend = false; // a real directory, not a link to one
+  bool matched = false;
+};
+
+struct Listing
+{
+  Job job;
+  std::vector<Child> children;
+  std::error_code error;
+  std::chrono::duration<double, std::milli> latency{};
+  // the directory was already read through another path
+  bool duplicate = false;
+  // ids of the directories queued below it, in listing order
+  std::vector<uint64_t> below;
+};
+
+// Closes a Win32 handle when it goes out of scope.
+struct ScopedHandle
+{
+  HANDLE handle;
+  ~ScopedHandle()
+  {
+    if (handle != INVALID_HANDLE_VALUE) {
+      CloseHandle(handle);
+    }
+  }
+};
+
+/**
+ * Returns a key identifying the directory open as 'handle' regardless
+ * of the path used to reach it (volume serial number and file ID), or 0
+ * if the file system doesn't provide one.
+ */
+inline uint64_t
+DirectoryIdentity(HANDLE handle)
+{
+  FILE_ID_INFO id_info;
+  if (GetFileInformationByHandleEx(
+        handle, FileIdInfo, &id_info, sizeof(id_info))) {
+    uint64_t high = 0;
+    uint64_t low = 0;
+    static_assert(sizeof(id_info.FileId) == 2 * sizeof(uint64_t));
+    std::memcpy(&low, id_info.FileId.Identifier, sizeof(low));
+    std::memcpy(
+      &high, id_info.FileId.Identifier + sizeof(low), sizeof(high));
+    if (high != 0 || low != 0) {
+      return HashIdentity(id_info.VolumeSerialNumber, high, low);
+    }
+  }
+  // older servers and file systems only support the 64 bit index
+  BY_HANDLE_FILE_INFORMATION info;
+  if (GetFileInformationByHandle(handle, &info)) {
+    const uint64_t index =
+      (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    if (index != 0) {
+      return HashIdentity(info.dwVolumeSerialNumber, 0, index);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads one directory. Runs on a reader thread, so names are folded
+ * here in parallel rather than on the search thread.
+ *
+ * The directory is opened once and that handle is used both to
+ * identify it and to list it, so cycle detection costs no extra round
+ * trip to a network share. Directories already in 'visited' are not
+ * listed.
+ */
+inline Listing
+ReadDirectory(Job job, bool include_files, VisitedSet& visited)
+{
+  Listing listing;
+  listing.job = std::move(job);
+
+  trace::Span span("read directory");
+  if (trace::Enabled()) {
+    span.SetArg(WideToUtf8(listing.job.path.generic_wstring()));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  ScopedHandle dir{ CreateFileW(
+    listing.job.path.c_str(),
+    FILE_LIST_DIRECTORY | FILE_READ_ATTRIBUTES,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_FLAG_BACKUP_SEMANTICS,
+    nullptr) };
+  if (dir.handle == INVALID_HANDLE_VALUE) {
+    listing.error =
+      std::error_code(GetLastError(), std::system_category());
+    listing.latency = std::chrono::steady_clock::now() - start;
+    return listing;
+  }
+  const uint64_t identity = DirectoryIdentity(dir.handle);
+
+  // 64 KiB is the largest batch SMB servers hand out in one reply
+  std::vector<uint64_t> buffer(64 * 1024 / sizeof(uint64_t));
+  const auto buffer_size = static_cast<DWORD>(buffer.size() * 8);
+  bool first = true;
+  while (true) {
+    const auto info_class =
+      first ? FileFullDirectoryRestartInfo : FileFullDirectoryInfo;
+    if (!GetFileInformationByHandleEx(
+          dir.handle, info_class, buffer.data(), buffer_size)) {
+      const auto code = GetLastError();
+      if (code != ERROR_NO_MORE_FILES) {
+        listing.error = std::error_code(code, std::system_category());
+      }
+      if (first) {
+        listing.latency = std::chrono::steady_clock::now() - start;
+      }
+      break;
+    }
+    if (first) {
+      // opening the directory and getting the first batch of entries
+      // is the round trip the controller reacts to
+      listing.latency = std::chrono::steady_clock::now() - start;
+      first = false;
+      // Only claim the identity once the directory could be read, so a
+      // retried read isn't mistaken for a duplicate.
+      if (identity != 0 &&
+          visited.Insert(identity) == VisitedSet::Result::present) {
+        listing.duplicate = true;
+        return listing;
+      }
+    }
+
+    auto* bytes = reinterpret_cast<const char*>(buffer.data());
+    while (true) {
+      const auto* info =
+        reinterpret_cast<const FILE_FULL_DIR_INFO*>(bytes);
+      const std::wstring_view name(
+        info->FileName, info->FileNameLength / sizeof(WCHAR));
+      const auto attributes = info->FileAttributes;
+      const bool is_directory = attributes & FILE_ATTRIBUTE_DIRECTORY;
+      if (name != L"." && name != L".." &&
+          (is_directory || include_files)) {
+        // for reparse points EaSize holds the reparse tag
+        const bool is_link =
+          (attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+          (info->EaSize == IO_REPARSE_TAG_SYMLINK ||
+           info->EaSize == IO_REPARSE_TAG_MOUNT_POINT);
+        Child child;
+        child.path = listing.job.path / name;
+        child.name = FoldedString(child.path);
+        child.is_directory = is_directory;
+        child.descend = is_directory && !is_link;
+        listing.children.push_back(std::move(child));
+      }
+      if (info->NextEntryOffset == 0) {
+        break;
+      }
+      bytes += info->NextEntryOffset;
+    }
+  }
+  return listing;
+}
+
+/**
+ * Reader threads pull directories from 'jobs' and push listings to
+ * 'done'. Threads are joined on destruction.
+ */
+class Readers
+{
+private:
+  std::vector<std::future<void>> tasks_;
+  bool include_files_;
+  VisitedSet& visited_;
+  const Matcher& matcher_;
+
+public:
+  std::mutex mutex;
+  std::condition_variable jobs_ready;
+  std::condition_variable done_ready;
+  std::deque<Job> jobs;
+  std::deque<Listing> done;
+  bool stop = false;
+
+  // Runs 'count' reader loops on 'pool', which needs that many free
+  // workers besides the calling one.
+  Readers(ThreadPool& pool,
+          int count,
+          bool include_files,
+          VisitedSet& visited,
+          const Matcher& matcher)
+    : include_files_(include_files)
+    , visited_(visited)
+    , matcher_(matcher)
+  {
+    for (int i = 0; i < count; ++i) {
+      tasks_.push_back(pool.Submit([this]() { Run(); }));
+    }
+  }
+
+  ~Readers()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    jobs_ready.notify_all();
+    for (auto& task : tasks_) {
+      task.wait();
+    }
+  }
+
+  void Run()
+  {
+    if (trace::Enabled()) {
+      trace::NameThread("reader");
+    }
+    // Entries are matched here, spread over the readers, rather than
+    // on the thread that merges the listings. std::regex isn't cheap
+    // to share between threads, so every reader has its own copy.
+    const Matcher matcher = matcher_;
+    while (true) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs_ready.wait(lock,
+                        [this]() { return stop || !jobs.empty(); });
+        if (stop) {
+          return;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      auto listing =
+        ReadDirectory(std::move(job), include_files_, visited_);
+      {
+        trace::Span span("match listing");
+        for (auto& child : listing.children) {
+          child.matched = matcher.Matches(child.name.folded);
+        }
+        if (trace::Enabled()) {
+          span.SetArg(std::to_string(listing.children.size()) +
+                      " entries");
+        }
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(std::move(listing));
+      }
+      done_ready.notify_one();
+    }
+  }
+};
+
+} // namespace walk_detail
+
+/**
+ * Walk the tree below 'root' with several directory reads in flight at
+ * once; see ReadController for how many.
+ *
+ * 'depth' limits how far below the root entries are reported (1 = the
+ * root's children only), zero or less is unlimited. Files are reported
+ * only if 'include_files' is set. Excluded directories are neither
+ * reported nor read. Links to directories are reported but not
+ * followed. A directory reached again through another path (a share
+ * mounted inside itself, a server side junction) is skipped using
+ * 'visited', which may be shared by several walks of one search.
+ *
+ * Entries are matched against 'matcher' by the reader threads, which
+ * run on 'pool' (see Readers). 'on_match(std::string&& text)' is called
+ * with the UTF-8 path of every match, on the calling thread only.
+ * Matches arrive in the same order however the reads were timed:
+ * directories depth first, pre-order, each directory's entries in
+ * listing order. Only a directory reached through two paths is
+ * reported under whichever path was read first. 'should_stop' is
+ * polled to cancel the walk.
+ *
+ * A directory that can't be read is skipped and recorded in 'stats'
+ * (see SearchStats::AddSkipped), the walk continues without it.
+ */
+template<typename OnMatch, typename ShouldStop>
+void
+Walk(const std::filesystem::path& root,
+     int depth,
+     bool include_files,
+     const DirectoryFilter& filter,
+     const WalkLimits& limits,
+     VisitedSet& visited,
+     ThreadPool& pool,
+     const Matcher& matcher,
+     SearchStats& stats,
+     OnMatch on_match,
+     ShouldStop should_stop)
+{
+  using namespace walk_detail;
+
+  ReadController controller(limits);
+  Readers readers(pool,
+                  limits.readers(),
+                  include_files,
+                  visited,
+                  matcher);
+
+  // Directories not read yet. Taken from the back so the walk stays
+  // depth first: the frontier holds the unread children of the
+  // directories on the current path, which grows with depth times
+  // fan-out rather than with the size of the tree.
+  std::vector<Job> frontier;
+  frontier.push_back(Job{ root, 0, 0, 0 });
+  uint64_t next_id = 1;
+  int in_flight = 0;
+
+  // Listings are released in a fixed order rather than as reads
+  // complete. The directories below a listing are queued for reading
+  // as soon as it arrives, so a listing waiting for its turn doesn't
+  // hold up the reads under it; its matches are only reported once
+  // every listing before it in pre-order was. 'release' holds the ids
+  // of the directories not released yet, next one at the back.
+  // Listings read ahead of their turn wait in 'completed'.
+  std::vector<uint64_t> release{ 0 };
+  std::unordered_map<uint64_t, Listing> completed;
+  // reads that failed with a transient error, waiting to be retried
+  std::vector<Job> retries;
+
+  while (!release.empty()) {
+    if (should_stop()) {
+      return;
+    }
+
+    if ((!frontier.empty() || !retries.empty()) &&
+        in_flight < controller.limit()) {
+      const auto now = std::chrono::steady_clock::now();
+      {
+        std::lock_guard<std::mutex> lock(readers.mutex);
+        for (size_t i = 0;
+             i < retries.size() && in_flight < controller.limit();) {
+          if (retries[i].not_before > now) {
+            ++i;
+            continue;
+          }
+          readers.jobs.push_back(std::move(retries[i]));
+          retries.erase(retries.begin() + i);
+          in_flight++;
+        }
+        while (!frontier.empty() && in_flight < controller.limit()) {
+          readers.jobs.push_back(std::move(frontier.back()));
+          frontier.pop_back();
+          in_flight++;
+        }
+      }
+      readers.jobs_ready.notify_all();
+      stats.peak_concurrent_reads =
+        std::max(stats.peak_concurrent_reads, in_flight);
+    }
+
+    std::deque<Listing> ready;
+    {
+      // wake up regularly so that a cancelled search stops promptly
+      std::unique_lock<std::mutex> lock(readers.mutex);
+      readers.done_ready.wait_for(
+        lock, std::chrono::milliseconds(50), [&readers]() {
+          return !readers.done.empty();
+        });
+      ready.swap(readers.done);
+    }
+
+    for (auto& listing : ready) {
+      in_flight--;
+      if (!listing.error) {
+        controller.OnSuccess(listing.latency);
+      } else if (IsTransientReadError(listing.error) &&
+                 listing.children.empty() &&
+                 listing.job.attempts + 1 < kMaxReadAttempts) {
+        // only retried if nothing was listed, otherwise entries would
+        // be reported twice
+        controller.OnError();
+        stats.read_retries++;
+        const auto delay = kRetryDelay * (1 << listing.job.attempts);
+        listing.job.not_before =
+          std::chrono::steady_clock::now() + delay;
+        listing.job.attempts++;
+        retries.push_back(std::move(listing.job));
+        continue;
+      }
+      if (!listing.duplicate) {
+        std::erase_if(listing.children, [&](const Child& child) {
+          if (child.is_directory &&
+              filter.Excludes(child.name.folded_name())) {
+            stats.directories_pruned++;
+            return true;
+          }
+          return false;
+        });
+        const int child_depth = listing.job.depth + 1;
+        for (auto& child : listing.children) {
+          if (child.descend && (depth <= 0 || child_depth < depth)) {
+            listing.below.push_back(next_id);
+            frontier.push_back(
+              Job{ std::move(child.path), child_depth, 0, next_id++ });
+          }
+        }
+        // the first child is read first
+        std::reverse(frontier.end() - listing.below.size(),
+                     frontier.end());
+        stats.peak_pending_directories =
+          std::max(stats.peak_pending_directories,
+                   static_cast<int>(frontier.size()));
+      }
+      const auto id = listing.job.id;
+      completed.emplace(id, std::move(listing));
+    }
+
+    while (!release.empty()) {
+      const auto it = completed.find(release.back());
+      if (it == completed.end()) {
+        break; // its read hasn't finished
+      }
+      release.pop_back();
+      auto listing = std::move(it->second);
+      completed.erase(it);
+
+      trace::Span span("merge listing");
+      if (listing.error) {
+        // Leave the directory out and carry on with the rest of the
+        // walk. Whatever was listed before a failure part way through
+        // is still searched.
+        const auto path =
+          WideToUtf8(listing.job.path.generic_wstring());
+        auto reason = ReadErrorReason(listing.error);
+        logs::walk()->warn("skipped '{}': {}", path, reason);
+        stats.AddSkipped(path, std::move(reason));
+        if (listing.children.empty()) {
+          continue;
+        }
+      }
+      if (listing.duplicate) {
+        stats.duplicates_skipped++;
+        FINDIR_DEBUG_EVERY(
+          logs::walk(),
+          100,
+          "already searched, skipped: {}",
+          WideToUtf8(listing.job.path.generic_wstring()));
+        continue;
+      }
+      stats.directories_read++;
+
+      if (trace::Enabled()) {
+        span.SetArg(std::to_string(listing.children.size()) +
+                    " entries");
+      }
+      // the first directory below is released first
+      release.insert(
+        release.end(), listing.below.rbegin(), listing.below.rend());
+      for (auto& child : listing.children) {
+        if (child.matched) {
+          on_match(std::move(child.name.text));
+        }
+      }
+    }
+  }
+}
+
+#endif /* FINDIR_WALKER_H */
@@ -0,0 +1,267 @@
+/**
+ *
+ * License: MIT
+ *
+ * Author: George Kuegler
+ * E-mail: georgekuegler@gmail.com
+ *
+ */
+
+// Tests of the search engine against directory trees made in the temp
+// directory. Prints each failed check and returns nonzero if any
+// failed.
+//
+// usage: find-directory-engine-tests.exe
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "engine.h"
+#include "text.h"
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+#define CHECK(condition)                                               \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__,      \
+              #condition);                                             \
+      failures++;                                                      \
+    }                                                                  \
+  } while (0)
+
+// A directory in the temp directory, removed again when done.
+class TempTree
+{
+private:
+  fs::path root_;
+
+public:
+  explicit TempTree(const char* name)
+    : root_(fs::temp_directory_path() / name)
+  {
+    fs::remove_all(root_);
+    fs::create_directories(root_);
+  }
+
+  ~TempTree()
+  {
+    std::error_code ec;
+    fs::remove_all(root_, ec);
+  }
+
+  const fs::path& root() const { return root_; }
+
+  void Add(const char* relative_path)
+  {
+    fs::create_directories(root_ / relative_path);
+  }
+};
+
+struct Outcome
+{
+  std::set<std::string> names; // last component of every match
+  size_t results = 0;
+  int finished = 0; // times on_finished was called
+  SearchStats stats;
+};
+
+Outcome
+Search(SearchEngine& engine, const SearchQuery& query)
+{
+  Outcome outcome;
+  std::mutex mutex;
+  auto search = engine.Start(
+    query,
+    { [&](Strings&& batch) {
+       std::lock_guard<std::mutex> lock(mutex);
+       for (const auto& path : batch) {
+         outcome.names.insert(
+           WideToUtf8(PathFromUtf8(path).filename().wstring()));
+       }
+       outcome.results += batch.size();
+     },
+      [&](const SearchStats& stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        outcome.finished++;
+        outcome.stats = stats;
+      } });
+  search.Wait();
+  return outcome;
+}
+
+// Patterns are matched against the whole path, which includes the temp
+// directory, so they are anchored to the last component: 'name' finds
+// the entries whose names start with it.
+std::string
+NamePattern(const std::string& name)
+{
+  return "/" + name + "[^/]*$";
+}
+
+SearchQuery
+MakeQuery(const fs::path& root, const std::string& pattern, int depth)
+{
+  SearchQuery query;
+  query.root = WideToUtf8(root.wstring());
+  query.pattern = pattern;
+  query.mode = MatchMode::regex;
+  query.depth = depth;
+  return query;
+}
+
+void
+TestChildrenOnly(SearchEngine& engine)
+{
+  TempTree tree("find-directory-test-children");
+  tree.Add("Alpha");
+  tree.Add("beta");
+  tree.Add("ALPHABET/alpha inside");
+
+  const auto outcome =
+    Search(engine, MakeQuery(tree.root(), NamePattern("alpha"), 1));
+  CHECK(outcome.finished == 1);
+  CHECK(outcome.stats.error.empty());
+  CHECK(outcome.names ==
+        std::set<std::string>({ "Alpha", "ALPHABET" }));
+}
+
+void
+TestRecursive(SearchEngine& engine)
+{
+  TempTree tree("find-directory-test-recursive");
+  tree.Add("a/project 1/drawings");
+  tree.Add("a/project 2");
+  tree.Add("b/c/project 3");
+  tree.Add("b/c/other");
+  tree.Add("node_modules/project 4");
+
+  auto query = MakeQuery(tree.root(), NamePattern("project"), 3);
+  query.exclude_directories = { "node_modules" };
+  const auto outcome = Search(engine, query);
+  CHECK(outcome.finished == 1);
+  CHECK(outcome.stats.error.empty());
+  CHECK(outcome.names == std::set<std::string>({ "project 1",
+                                                 "project 2",
+                                                 "project 3" }));
+  CHECK(outcome.stats.directories_pruned == 1);
+
+  // 'drawings' is three levels down
+  query.pattern = NamePattern("draw");
+  query.depth = 2;
+  CHECK(Search(engine, query).names.empty());
+  query.depth = 3;
+  CHECK(Search(engine, query).names ==
+        std::set<std::string>({ "drawings" }));
+}
+
+void
+TestResultLimit(SearchEngine& engine)
+{
+  TempTree tree("find-directory-test-limit");
+  for (int i = 0; i < 50; i++) {
+    tree.Add(("folder " + std::to_string(i)).c_str());
+  }
+  auto query = MakeQuery(tree.root(), NamePattern("folder"), 1);
+  query.limits.max_results = 10;
+  const auto outcome = Search(engine, query);
+  CHECK(outcome.results == 10);
+  CHECK(outcome.stats.result_limit_reached);
+}
+
+void
+TestMissingRoot(SearchEngine& engine)
+{
+  const auto outcome = Search(
+    engine,
+    MakeQuery(fs::temp_directory_path() / "find-directory-test-missing",
+              "a",
+              0));
+  CHECK(outcome.finished == 1);
+  CHECK(!outcome.stats.error.empty());
+  CHECK(outcome.results == 0);
+}
+
+void
+TestCancel(SearchEngine& engine)
+{
+  TempTree tree("find-directory-test-cancel");
+  for (int i = 0; i < 40; i++) {
+    for (int j = 0; j < 50; j++) {
+      tree.Add(("folder " + std::to_string(i) + "/sub " +
+                std::to_string(j))
+                 .c_str());
+    }
+  }
+
+  // The first batch holds the search up until it was cancelled.
+  std::promise<void> first_batch;
+  std::promise<void> cancelled;
+  auto cancelled_future = cancelled.get_future().share();
+  std::atomic<bool> first = true;
+  std::atomic<int> finished = 0;
+  SearchStats stats;
+  auto search = engine.Start(
+    MakeQuery(tree.root(), "", 0),
+    { [&](Strings&&) {
+       if (first.exchange(false)) {
+         first_batch.set_value();
+         cancelled_future.wait();
+       }
+     },
+      [&](const SearchStats& s) {
+        stats = s;
+        finished++;
+      } });
+  first_batch.get_future().wait();
+  search.Cancel();
+  cancelled.set_value();
+  search.Wait();
+  CHECK(search.Done());
+  CHECK(finished == 1);
+  CHECK(stats.cancelled);
+}
+
+void
+TestSubmit(SearchEngine& engine)
+{
+  std::atomic<int> runs = 0;
+  engine.Submit([&]() { runs++; }).get();
+  CHECK(runs == 1);
+
+  bool thrown = false;
+  try {
+    engine.Submit([]() { throw std::runtime_error("task failed"); })
+      .get();
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+int
+main()
+{
+  SearchEngine engine;
+  TestChildrenOnly(engine);
+  TestRecursive(engine);
+  TestResultLimit(engine);
+  TestMissingRoot(engine);
+  TestCancel(engine);
+  TestSubmit(engine);
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all tests passed\n");
+  return 0;
+}